@@ -3,27 +3,285 @@
 
 #include "config.h"
 #include "complex_helpers.h"
+#include "fractal_common.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
 
-struct thread_info_t {
-        int width;
+#ifndef EGFRACTAL_MULTITHREADED
+# define EGFRACTAL_MULTITHREADED 0
+#endif
+
+/* hist.c */
+/*
+ * struct hist_cache_t - One thread's cache of counts on their way to
+ *                       the shared histogram
+ * @hist: The shared histogram
+ * @idx: Which counter each slot is counting for
+ * @n: How many we've counted for it since it went into the slot
+ *
+ * Counter number i only ever goes into slot i % HIST_CACHE_SIZE.
+ * See the comment at the top of hist.c.
+ */
+enum { HIST_CACHE_SIZE = 512 };
+struct hist_t;
+struct hist_cache_t {
+        struct hist_t *hist;
+        size_t idx[HIST_CACHE_SIZE];
+        uint32_t n[HIST_CACHE_SIZE];
+};
+extern struct hist_t *hist_create(size_t size);
+extern void hist_destroy(struct hist_t *h);
+extern unsigned long hist_get(const struct hist_t *h, size_t idx);
+extern struct hist_cache_t *hist_cache_create(struct hist_t *h);
+extern void hist_cache_evict(struct hist_cache_t *hc, unsigned int slot);
+extern void hist_cache_flush(struct hist_cache_t *hc);
+extern void hist_cache_destroy(struct hist_cache_t *hc);
+extern int hist_write(const struct hist_t *h, FILE *fp);
+extern int hist_read_add(struct hist_t *h, FILE *fp);
+
+/* Add @n to counter @idx of @hc's histogram */
+static inline __attribute__((always_inline)) void
+hist_add(struct hist_cache_t *hc, size_t idx, uint32_t n)
+{
+        unsigned int slot = idx & (HIST_CACHE_SIZE - 1);
+        if (hc->idx[slot] != idx || hc->n[slot] > UINT32_MAX - n) {
+                if (hc->n[slot] != 0)
+                        hist_cache_evict(hc, slot);
+                hc->idx[slot] = idx;
+        }
+        hc->n[slot] += n;
+}
+
+/* Add one to counter @idx of @hc's histogram */
+static inline __attribute__((always_inline)) void
+hist_inc(struct hist_cache_t *hc, size_t idx)
+{
+        hist_add(hc, idx, 1);
+}
+
+/*
+ * struct prefilter_t - Which parts of the sampling area have paths
+ *                      that reach a zoomed-in picture
+ * @tileq: For handing out the grid to prefilter_thread()
+ * @ok: PREFILTER_SIZE x PREFILTER_SIZE grid over [-2:1] x [-1.5:1.5],
+ *      true for each cell that might
+ * @ok_tmp: Scratch space for prefilter_dilate(), same size
+ *
+ * PREFILTER_SUB x PREFILTER_SUB points are tried in each cell.
+ * See the comments in bbrot_thread.c
+ */
+enum { PREFILTER_SIZE = 512, PREFILTER_SUB = 3 };
+struct prefilter_t {
+        struct tileq_t tileq;
+        unsigned char *ok;
+        unsigned char *ok_tmp;
+};
+
+enum sampler_t {
+        SAMPLER_UNIFORM,
+        SAMPLER_MH,
+};
+
+/* How a point's hit is spread over the histogram, see save_to_hist() */
+enum splat_t {
+        SPLAT_NEAREST,
+        SPLAT_BILINEAR,
+};
+enum { SPLAT_BITS = 4, SPLAT_ONE = 1 << SPLAT_BITS };
+
+struct params_t {
+        int n_red;
+        int n_green;
+        int n_blue;
         int height;
-        int nchan;
+        int width;
         int min;
+        int nthread; /* 0 for one per CPU */
+        mfloat_t bailout;
+        mfloat_t bailsqu;
+        mfloat_t line_y;
+        mfloat_t line_x;
+        mfloat_t zoom_pct;
+        mfloat_t zoom_xoffs;
+        mfloat_t zoom_yoffs;
+        double eq_exp;
+        double rmout_scale;
         unsigned long points;
+        uint64_t seed;
+        uint64_t first;         /* number of the first point to do */
+        bool singlechan;
+        bool do_hist;
+        bool verbose;
+        bool use_line_y;
+        bool use_line_x;
+        bool negate;
+        bool rmout;
+        bool linked;
+        bool affinity;
+        bool prefilter;
+        bool simd;
+        enum sampler_t sampler;
+        enum splat_t splat;
+        int supersample;        /* histogram cells per pixel, each way */
+        int depth;              /* bits per channel of a PNG */
+        complex_t (*formula)(complex_t, complex_t);
+        const char *formula_name;
+        const char *overlay;
+        /* Checkpoints, see dump.c */
+        const char *dump;
+        unsigned int dump_every;        /* seconds, zero for never */
+        const char **resume;
+        int nresume;
+        unsigned long points_done;      /* in the --resume files */
+};
+
+/* A point's path, as it stands in a Metropolis-Hastings Markov chain */
+struct mh_point_t {
+        complex_t c;
+        int len;                /* orbit_iterate()'s return value */
+        unsigned int chanmask;  /* see save_to_hist() */
+        unsigned long f;        /* hits it makes in the histogram; zero
+                                 * until the chain gets started */
+};
+
+/*
+ * struct stop_t - Reasons for the threads to stop early
+ * @quit: Set by SIGINT or SIGTERM; save and quit
+ * @checkpoint: Set by SIGALRM; save and keep going
+ *
+ * The threads look at these every so often, and if either one is set,
+ * they save where they were in thread_info_t and return, so that
+ * the histogram can be written out.
+ */
+struct stop_t {
+        volatile sig_atomic_t quit;
+        volatile sig_atomic_t checkpoint;
+};
+
+/*
+ * struct pointq_t - Hands out point numbers to the threads
+ * @next: The first point number nobody has taken yet.  This can go
+ *        past @end, since the threads take them a batch at a time.
+ * @end: One past the last point number to do
+ *
+ * Every batch a thread takes, it finishes, so once they've all
+ * returned, every point before @next (or @end) is done.
+ */
+struct pointq_t {
+        uint64_t next;
+        uint64_t end;
+};
+
+struct thread_info_t {
+        int width;              /* of the histogram, which is */
+        int height;             /* --supersample times the picture's */
+        int nchan;
+        int min;
         int n[3];
-        unsigned long *_chanbuf_base;
-        unsigned long *chanbuf[3];
-        unsigned short seeds[6];
+        int maxn;               /* biggest of @n */
+        int npx;
+        struct hist_cache_t *hist;
+        uint64_t seed;
+        struct pointq_t *pointq;
         complex_t (*formula)(complex_t, complex_t);
-        mfloat_t wthird;
-        mfloat_t hthird;
+        /* Picture's corner, and pixels per unit */
+        mfloat_t re0;
+        mfloat_t im0;
+        mfloat_t wscale;
+        mfloat_t hscale;
         mfloat_t bailsqu;
+        mfloat_t period_eps;
+        unsigned long nperiodic; /* points caught by periodicity check */
+        unsigned long niter;     /* iterations, for the progress report */
+        complex_t *orbit;       /* path of the current point */
+        complex_t *orbit_mh;    /* path of the chain's current point */
+        enum sampler_t sampler;
+        enum splat_t splat;
+        struct mh_point_t mh;   /* --sampler=mh's chain */
+        struct stop_t *stop;
+        struct prefilter_t *prefilter; /* NULL unless zoomed in */
+        struct lanes_t *lanes;  /* NULL unless plain z^2+c, uniform */
+        struct progress_t *progress; /* NULL unless --verbose */
         double line_x, line_y;
         bool use_line_x, use_line_y;
 };
 
+/*
+ * struct lanes_t - SIMD lanes of paths in progress, see lanes.c
+ * @re: Ring buffer of every lane's z.re, one row of lanes per step
+ * @im: Same for z.im
+ * @mask: Number of rows in the ring, minus one
+ * @t: Number of steps taken so far
+ *
+ * The rest are what each lane was up to when lanes_run() returned.
+ */
+enum { LANES_MAX = 8 };
+struct lanes_t {
+        mfloat_t *re;
+        mfloat_t *im;
+        size_t mask;
+        uint64_t t;
+        mfloat_t zr[LANES_MAX];
+        mfloat_t zi[LANES_MAX];
+        mfloat_t cr[LANES_MAX];
+        mfloat_t ci[LANES_MAX];
+        mfloat_t sr[LANES_MAX];
+        mfloat_t si[LANES_MAX];
+        long long it[LANES_MAX];
+        long long save[LANES_MAX];
+        bool live[LANES_MAX];
+};
+
 /* bbrot_thread.c */
-extern void *bbrot_thread(void *arg);
+extern void bbrot_thread(void *arg);
+extern void lanes_splat(struct thread_info_t *ti, const mfloat_t *re,
+                        const mfloat_t *im, int stride, uint64_t t0,
+                        size_t mask, int len);
+extern void prefilter_thread(void *arg);
+extern double prefilter_dilate(struct prefilter_t *pf);
+
+/* lanes.c */
+extern const char *lanes_isa_name(void);
+extern struct lanes_t *lanes_create(int maxn);
+extern void lanes_destroy(struct lanes_t *ln);
+extern void lanes_run(struct lanes_t *ln, struct thread_info_t *ti,
+                      const complex_t *c, size_t nc, bool drain);
+
+/* rng.c */
+/* What each point's random numbers are for, see rng_get() */
+enum {
+        RNG_POINT,      /* the point itself, see rng_points() */
+        RNG_MH_STEP,    /* Metropolis-Hastings: which move, and accept? */
+        RNG_MH_NUDGE,   /* ...how far and which way to nudge */
+        RNG_MH_ROUND,   /* ...seed for rounding off the weights */
+};
+extern void rng_get(uint64_t seed, uint64_t i, unsigned int stream,
+                    uint64_t out[2]);
+extern void rng_points(uint64_t seed, uint64_t first, size_t n,
+                       double *u, double *v);
+
+/*
+ * Turn 64 random bits into a number in [0:1).  The top 52 of them go
+ * into the mantissa of a number in [1:2), which is quicker than
+ * converting an integer, and easier for the compiler to vectorize.
+ */
+static inline __attribute__((always_inline)) double
+rng_to_unit(uint64_t x)
+{
+        double d;
+        x = (x >> 12) | 0x3ff0000000000000ull;
+        memcpy(&d, &x, sizeof(d));
+        return d - 1.0;
+}
+
+/* dump.c */
+extern int dump_write(const char *path, const struct params_t *params,
+                      const struct hist_t *hist, uint64_t next);
+extern void dump_read_params(const char *path, struct params_t *params);
+extern void dump_read_hist(const char *path, struct params_t *params,
+                           struct hist_t *hist);
 
 #endif /* BBROT2_H */
 
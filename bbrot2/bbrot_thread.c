@@ -1,14 +1,105 @@
 #include "bbrot2.h"
 #include "fractal_common.h"
 #include <stdint.h>
+#include <string.h>
 
+/*
+ * Find the histogram index (in channel zero) of the pixel where @z is.
+ * Return false if it's outside the picture.
+ */
+static inline __attribute__((always_inline)) bool
+pixel_of(const struct thread_info_t *ti, complex_t z, size_t *idx)
+{
+        unsigned int col = (int)(ti->wscale * (z.re - ti->re0) + 0.5);
+        unsigned int row = (int)(ti->hscale * (z.im - ti->im0) + 0.5);
+        if (col >= ti->width || row >= ti->height)
+                return false;
+        *idx = row * ti->width + col;
+        return true;
+}
+
+/*
+ * Find where @z is in pixels, for --splat=bilinear, and return true if
+ * that's close enough to the picture for some of it to land in it.
+ */
+static inline bool
+splat_pos(const struct thread_info_t *ti, complex_t z,
+          mfloat_t *x, mfloat_t *y)
+{
+        *x = ti->wscale * (z.re - ti->re0);
+        *y = ti->hscale * (z.im - ti->im0);
+        /* Also throws out NaN */
+        return *x > -1.0 && *x < ti->width && *y > -1.0 && *y < ti->height;
+}
+
+/*
+ * --splat=bilinear: Split @n hits of @z among the four pixels around it,
+ * in every channel in @chanmask, by how close it is to each one's
+ * center.  The weights are fixed-point, with SPLAT_BITS of sub-pixel
+ * position each way, so each hit adds up to SPLAT_ONE * SPLAT_ONE and
+ * the histogram stays in integers.
+ */
+static void
+splat_bilinear(struct thread_info_t *ti, unsigned int chanmask,
+               complex_t z, uint32_t n)
+{
+        mfloat_t x, y;
+        uint32_t wx[2], wy[2];
+        int col, row, dx, dy;
+
+        if (!splat_pos(ti, z, &x, &y))
+                return;
+
+        /* floor(), since they're more than -1 */
+        col = (int)(x + 1.0) - 1;
+        row = (int)(y + 1.0) - 1;
+        wx[1] = (uint32_t)((x - col) * SPLAT_ONE);
+        wy[1] = (uint32_t)((y - row) * SPLAT_ONE);
+        wx[0] = SPLAT_ONE - wx[1];
+        wy[0] = SPLAT_ONE - wy[1];
+
+        for (dy = 0; dy < 2; dy++) {
+                if (row + dy < 0 || row + dy >= ti->height || !wy[dy])
+                        continue;
+                for (dx = 0; dx < 2; dx++) {
+                        size_t idx;
+                        int chan;
+
+                        if (col + dx < 0 || col + dx >= ti->width || !wx[dx])
+                                continue;
+                        idx = (row + dy) * ti->width + col + dx;
+                        for (chan = 0; chan < ti->nchan; chan++) {
+                                if (chanmask & (1u << chan)) {
+                                        hist_add(ti->hist, idx,
+                                                 n * wx[dx] * wy[dy]);
+                                }
+                                idx += ti->npx;
+                        }
+                }
+        }
+}
+
+/*
+ * Add one to every channel in @chanmask (bit i for channel i) at the
+ * pixel where @c is
+ */
 static inline void __attribute__((always_inline))
-save_to_hist(struct thread_info_t *ti, int chan, complex_t c)
+save_to_hist(struct thread_info_t *ti, unsigned int chanmask, complex_t c)
 {
-        unsigned int col = (int)(ti->wthird * (c.re + 2.0) + 0.5);
-        unsigned int row = (int)(ti->hthird * (c.im + 1.5) + 0.5);
-        if (col < ti->width && row < ti->height)
-                ti->chanbuf[chan][row * ti->width + col]++;
+        size_t idx;
+        int chan;
+
+        if (ti->splat == SPLAT_BILINEAR) {
+                splat_bilinear(ti, chanmask, c, 1);
+                return;
+        }
+        if (!pixel_of(ti, c, &idx))
+                return;
+        for (chan = 0; chan < ti->nchan; chan++) {
+                if (chanmask & (1u << chan))
+                        hist_inc(ti->hist, idx);
+                idx += ti->npx;
+        }
 }
 
 /* Return true if inside cardioid or main bulb */
@@ -27,26 +118,39 @@ inside_cardioid_or_bulb(complex_t c)
 }
 
 /*
- * This function runs twice - First just to see if it diverges
- * and again to save the points of the path from @c if it does
- * in fact diverge.
+ * Brent's periodicity check.  @zs is z as of iteration number @save.
+ * Return true if @ztmp has come back around to it.
+ */
+static inline __attribute__((always_inline)) bool
+periodic(complex_t ztmp, complex_t *zs, int i, int *save, mfloat_t eps2)
+{
+        if (complex_modulus2(complex_sub(ztmp, *zs)) < eps2)
+                return true;
+        if (i == *save) {
+                *zs = ztmp;
+                *save *= 2;
+        }
+        return false;
+}
+
+/*
+ * Iterate @c up to the biggest of the channels' numbers of iterations,
+ * or until we know how its path ends, storing every z along the way
+ * in @ti->orbit.
  *
- * Repeating this long iterative process twice sounds like it takes
- * a long time, and it does.  One alternative is to save everything
- * into the histogram @buf and save all the same points in a second
- * buffer, so that we can undo our modification of @buf should the
- * path not diverge.  However, this has experimentally proven to
- * take much longer.  It turns out that the process of saving data
- * into @hist (which includes the slightly mathy save_to_hist() above)
- * is time-consuming, and it's just faster if we don't do that unless
- * we already know the path diverges.
+ * Return the number of iterations it took for the path to escape, or
+ * zero if it didn't.
  */
-static void
-iterate_r(complex_t c, unsigned int chan,
-                struct thread_info_t *ti, bool isdivergent)
+static int
+orbit_iterate(complex_t c, struct thread_info_t *ti)
 {
-        int i;
+        complex_t *orbit = ti->orbit;
         complex_t z = { .re = 0.0L, .im = 0.0L };
+        complex_t zs = z;
+        mfloat_t eps2 = ti->period_eps * ti->period_eps;
+        int i, save = 1, n = ti->maxn;
+        int ret = 0;
+
         /*
          * It looks like a horrible D.R.Y. violation to have this
          * "if" statement be outside the "for" loop, since the
@@ -55,7 +159,7 @@ iterate_r(complex_t c, unsigned int chan,
          * shown to increase by a noticeable amount when this happens.
          */
         if (ti->formula) {
-                for (i = 0; i < ti->n[chan]; i++) {
+                for (i = 0; i < n; i++) {
                         /*
                          * Wow! The overhead of a non-inline function
                          * call for every iteration!  One which itself
@@ -69,106 +173,501 @@ iterate_r(complex_t c, unsigned int chan,
                          * absolutely no improvement on speed.
                          */
                         complex_t ztmp = ti->formula(z, c);
-
-                        if (isdivergent && i > ti->min)
-                                save_to_hist(ti, chan, ztmp);
+                        orbit[i] = ztmp;
 
                         /* Check both bailout and periodicity */
                         if (ztmp.re == z.re && ztmp.im == z.im)
-                                return;
+                                break;
                         if (complex_modulus2(ztmp) >= ti->bailsqu) {
-                                if (!isdivergent)
-                                        iterate_r(c, chan, ti, true);
-                                return;
+                                ret = i + 1;
+                                break;
+                        }
+                        if (periodic(ztmp, &zs, i, &save, eps2)) {
+                                ti->nperiodic++;
+                                break;
                         }
 
                         z = ztmp;
                 }
         } else {
-                for (i = 0; i < ti->n[chan]; i++) {
+                for (i = 0; i < n; i++) {
                         /* next z = z^2 + c */
                         complex_t ztmp = complex_add(complex_sq(z), c);
-                        if (isdivergent && i > ti->min)
-                                save_to_hist(ti, chan, ztmp);
+                        orbit[i] = ztmp;
 
                         /* Check both bailout and periodicity */
                         if (complex_modulus2(ztmp) >= ti->bailsqu
                             || (ztmp.re == z.re && ztmp.im == z.im)) {
-                                if (!isdivergent)
-                                        iterate_r(c, chan, ti, true);
-                                return;
+                                ret = i + 1;
+                                break;
+                        }
+                        if (periodic(ztmp, &zs, i, &save, eps2)) {
+                                ti->nperiodic++;
+                                break;
                         }
 
                         z = ztmp;
                 }
         }
+        /* If we broke out early, we still did iteration i */
+        ti->niter += i < n ? i + 1 : i;
+        return ret;
 }
 
-/* NORM3 converts result of rand48_ll to some point in [0:3) */
-#define NORM3  (3.0 / (double)MASK48)
-#define MASK48 (((uint64_t)1 << 48) - 1)
+/*
+ * Trace @c's path into every channel of the histogram whose number of
+ * iterations it diverges within.
+ *
+ * This used to iterate the whole path twice per channel: first just to
+ * see if it diverges, and again to save its points to the histogram if
+ * it did.  Saving to the histogram along the way, and undoing it if the
+ * path didn't diverge, was tried and was even slower, because
+ * save_to_hist() is the expensive part.  Storing z in a plain array is
+ * cheap, though, so now we iterate once, out to the biggest channel's
+ * limit, and then replay the array into the histogram once we know
+ * which channels the path diverges for.  The channels only differ in
+ * where they cut off, so one path serves all of them.
+ */
+static void
+iterate_r(complex_t c, struct thread_info_t *ti)
+{
+        unsigned int chanmask = 0;
+        int i, chan, len;
+
+        len = orbit_iterate(c, ti);
+        if (len == 0)
+                return;
+        for (chan = 0; chan < ti->nchan; chan++) {
+                if (len <= ti->n[chan])
+                        chanmask |= 1u << chan;
+        }
+        for (i = ti->min + 1; i < len; i++)
+                save_to_hist(ti, chanmask, ti->orbit[i]);
+}
+
+/**
+ * lanes_splat - Trace a path that escaped in one of the SIMD lanes
+ * @ti: Thread's info
+ * @re: The lane's column of the ring buffer of z.re
+ * @im: Same for z.im
+ * @stride: Number of lanes, the distance between rows of the ring
+ * @t0: Step number of the path's first point
+ * @mask: Number of rows in the ring, minus one
+ * @len: Number of points in the path, what orbit_iterate() would
+ *       have returned for it
+ *
+ * Same as the second half of iterate_r().
+ */
+void
+lanes_splat(struct thread_info_t *ti, const mfloat_t *re,
+            const mfloat_t *im, int stride, uint64_t t0,
+            size_t mask, int len)
+{
+        unsigned int chanmask = 0;
+        int i, chan;
+
+        for (chan = 0; chan < ti->nchan; chan++) {
+                if (len <= ti->n[chan])
+                        chanmask |= 1u << chan;
+        }
+        for (i = ti->min + 1; i < len; i++) {
+                size_t k = ((t0 + i) & mask) * stride;
+                complex_t z = { .re = re[k], .im = im[k] };
+                save_to_hist(ti, chanmask, z);
+        }
+}
+
+/*
+ * Return how many of the first @len points in @ti->orbit, not counting
+ * the first @ti->min, are in the picture.  With --splat=bilinear, that
+ * includes the ones just outside of it that splat part of a hit into it.
+ */
+static unsigned long
+orbit_hits(const struct thread_info_t *ti, int len)
+{
+        unsigned long n = 0;
+        int i;
+        for (i = ti->min + 1; i < len; i++) {
+                size_t idx;
+                mfloat_t x, y;
+                if (ti->splat == SPLAT_BILINEAR
+                    ? splat_pos(ti, ti->orbit[i], &x, &y)
+                    : pixel_of(ti, ti->orbit[i], &idx)) {
+                        n++;
+                }
+        }
+        return n;
+}
 
 /*
- * My own inline erand48().
+ * Prefilter for zoomed-in pictures
  *
- * Besides removing the overhead of a function call for every point,
- * I also reduce a mfloat_t multiplication, because I can directly
- * "normalize" to [0:3) instead of multiplying erand48()'s already-
- * normalized-to-[0:1) result.
+ * When zoomed in, most points' paths never come anywhere near the
+ * picture, and iterating them is a waste.  Before we start, we chop
+ * the sampling area up into a coarse grid, try a few points in each
+ * cell, and mark the cell if any of their paths hit the picture.  Then
+ * we throw away random points from unmarked cells without iterating.
  *
- * XXX REVISIT: Multiplying a 48-bit value with a 32-bit value will
- * cause overflow in a 64-bit word.
- * Will the result of an overflowing multiplication
- * always be modulo the correct answer, on any architecture?
- * If yes, then I don't care.
- * If no, then I need to handle this with 80-bit storage.
+ * This is a guess, not a proof; a cell could have a few points whose
+ * paths do hit the picture while the ones we tried don't.  To make
+ * that less likely, every neighbor of a marked cell gets marked too.
  */
-static inline __attribute__((always_inline)) uint64_t
-rand48_il(uint64_t old)
+
+static inline bool
+prefilter_ok(const struct prefilter_t *pf, complex_t c)
 {
-        /* Formula given by man (3) erand48 */
-        return (old * 0x5DEECE66Dul + 0xB) & MASK48;
+        unsigned int col = (int)((c.re + 2.0) * (PREFILTER_SIZE / 3.0));
+        unsigned int row = (int)((c.im + 1.5) * (PREFILTER_SIZE / 3.0));
+
+        /* --xline and --yline can go outside the grid */
+        if (col >= PREFILTER_SIZE || row >= PREFILTER_SIZE)
+                return true;
+        return pf->ok[row * PREFILTER_SIZE + col];
+}
+
+/* Return true if any of the points we try in grid cell @row, @col hit */
+static bool
+prefilter_cell(struct thread_info_t *ti, int row, int col)
+{
+        mfloat_t step = 3.0 / (PREFILTER_SIZE * PREFILTER_SUB);
+        int i, j;
+
+        for (i = 0; i < PREFILTER_SUB; i++) {
+                for (j = 0; j < PREFILTER_SUB; j++) {
+                        complex_t c;
+                        int len;
+
+                        c.re = -2.0 + step * (col * PREFILTER_SUB + j + 0.5);
+                        c.im = -1.5 + step * (row * PREFILTER_SUB + i + 0.5);
+                        if (!ti->formula && inside_cardioid_or_bulb(c))
+                                continue;
+                        len = orbit_iterate(c, ti);
+                        if (len != 0 && orbit_hits(ti, len) != 0)
+                                return true;
+                }
+        }
+        return false;
 }
 
 /**
- * bbrot_thread - POSIX thread routine for bbrot2,
- *              or just the main routine if no pthreads
+ * prefilter_thread - Thread pool task to fill in the prefilter grid
+ * @arg: Pointer to a struct thread_info_t, whose @prefilter is the grid
  */
-void *
-bbrot_thread(void *arg)
+void
+prefilter_thread(void *arg)
 {
-        uint64_t s48_x, s48_y;
         struct thread_info_t *ti = (struct thread_info_t *)arg;
-        unsigned long i;
+        struct prefilter_t *pf = ti->prefilter;
+        struct tile_t tile;
+
+        while (tileq_next(&pf->tileq, &tile)) {
+                int row, col;
+                for (row = tile.rowstart; row < tile.rowend; row++) {
+                        for (col = tile.colstart; col < tile.colend; col++) {
+                                pf->ok[row * PREFILTER_SIZE + col]
+                                        = prefilter_cell(ti, row, col);
+                        }
+                }
+        }
+}
 
-        s48_x = (uint64_t)ti->seeds[0] << 32
-                | (uint64_t)ti->seeds[1] << 16 | (uint64_t)ti->seeds[2];
-        s48_y = (uint64_t)ti->seeds[3] << 32
-                | (uint64_t)ti->seeds[4] << 16 | (uint64_t)ti->seeds[5];
+/**
+ * prefilter_dilate - Mark every neighbor of a marked cell
+ *
+ * Return the fraction of cells that are marked afterward.
+ */
+double
+prefilter_dilate(struct prefilter_t *pf)
+{
+        enum { N = PREFILTER_SIZE };
+        unsigned char *old = pf->ok_tmp;
+        unsigned long nok = 0;
+        int row, col;
 
-        for (i = 0; i < ti->points; i++) {
-                complex_t c;
-                int chan;
+        memcpy(old, pf->ok, N * N);
+        for (row = 0; row < N; row++) {
+                for (col = 0; col < N; col++) {
+                        int r, c;
+                        bool ok = false;
+                        for (r = row - 1; r <= row + 1 && !ok; r++) {
+                                for (c = col - 1; c <= col + 1; c++) {
+                                        if (r >= 0 && r < N && c >= 0
+                                            && c < N && old[r * N + c]) {
+                                                ok = true;
+                                                break;
+                                        }
+                                }
+                        }
+                        pf->ok[row * N + col] = ok;
+                        nok += ok;
+                }
+        }
+        return (double)nok / (N * N);
+}
+
+/* How many points a thread takes at a time */
+#define BATCH_POINTS 1024
 
-                if (ti->use_line_x) {
-                        c.re = ti->line_x;
-                } else {
-                        s48_x = rand48_il(s48_x);
-                        c.re = (double)s48_x * NORM3 - 2.0;
+/*
+ * Take the next batch of point numbers, the first of which goes in
+ * @first.  Return how many there are, zero if there are no more or
+ * we've been asked to stop.
+ */
+static size_t
+next_batch(struct thread_info_t *ti, uint64_t *first)
+{
+        struct pointq_t *q = ti->pointq;
+        uint64_t i;
+
+        if (ti->stop->quit || ti->stop->checkpoint)
+                return 0;
+        i = __atomic_fetch_add(&q->next, BATCH_POINTS, __ATOMIC_RELAXED);
+        if (i >= q->end)
+                return 0;
+        *first = i;
+        return q->end - i < BATCH_POINTS ? q->end - i : BATCH_POINTS;
+}
+
+/* Tell @ti->progress about the @n points we just did */
+static inline void
+report_batch(struct thread_info_t *ti, size_t n, unsigned long *niter)
+{
+        if (ti->progress)
+                progress_add(ti->progress, n, ti->niter - *niter);
+        *niter = ti->niter;
+}
+
+static void
+uniform_thread(struct thread_info_t *ti)
+{
+        double u[BATCH_POINTS], v[BATCH_POINTS];
+        complex_t cand[BATCH_POINTS];
+        unsigned long niter = ti->niter;
+        uint64_t first;
+        size_t j, n, nc;
+
+        while ((n = next_batch(ti, &first)) != 0) {
+                rng_points(ti->seed, first, n, u, v);
+                nc = 0;
+                for (j = 0; j < n; j++) {
+                        complex_t c;
+
+                        c.re = ti->use_line_x ? ti->line_x
+                                              : u[j] * 3.0 - 2.0;
+                        c.im = ti->use_line_y ? ti->line_y
+                                              : v[j] * 3.0 - 1.5;
+                        if (!ti->formula && inside_cardioid_or_bulb(c))
+                                continue;
+                        if (ti->prefilter
+                            && !prefilter_ok(ti->prefilter, c)) {
+                                continue;
+                        }
+                        if (ti->lanes)
+                                cand[nc++] = c;
+                        else
+                                iterate_r(c, ti);
                 }
-                if (ti->use_line_y) {
-                        c.im = ti->line_y;
-                } else {
-                        s48_y = rand48_il(s48_y);
-                        c.im = (double)s48_y * NORM3 - 1.5;
+                if (ti->lanes)
+                        lanes_run(ti->lanes, ti, cand, nc, false);
+                report_batch(ti, n, &niter);
+        }
+        /* Every batch we took has to be finished before we return */
+        if (ti->lanes) {
+                lanes_run(ti->lanes, ti, NULL, 0, true);
+                report_batch(ti, 0, &niter);
+        }
+}
+
+/*
+ * Metropolis-Hastings sampler
+ *
+ * Instead of picking every point at random, this picks each new point
+ * by nudging the last one that made it into the picture, so that we
+ * spend most of our time on points whose paths do show up, especially
+ * the long ones.  See "Metropolis-Hastings" in how-it-works.txt.
+ */
+
+/* Chance of trying a brand new random point instead of a nudge */
+#define MH_LARGE 0.1
+
+/* Biggest nudge, in pixels */
+#define MH_NUDGE 8.0
+
+/* SplitMix64, cheap random numbers for mh_save_to_hist()'s rounding */
+static inline uint64_t
+splitmix64(uint64_t *state)
+{
+        uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+}
+
+/*
+ * Iterate @p->c into @ti->orbit and count how many hits its path would
+ * make in the histogram, which is the function the Markov chain is
+ * trying to sample in proportion to.
+ */
+static void
+mh_eval(struct thread_info_t *ti, struct mh_point_t *p)
+{
+        complex_t c = p->c;
+        int chan, nchan = 0;
+
+        p->f = 0;
+        p->len = 0;
+        p->chanmask = 0;
+        if (c.re < -2.0 || c.re >= 1.0 || c.im < -1.5 || c.im >= 1.5)
+                return;
+        if (!ti->formula && inside_cardioid_or_bulb(c))
+                return;
+        if (ti->prefilter && !prefilter_ok(ti->prefilter, c))
+                return;
+        p->len = orbit_iterate(c, ti);
+        if (p->len == 0)
+                return;
+        for (chan = 0; chan < ti->nchan; chan++) {
+                if (p->len <= ti->n[chan]) {
+                        p->chanmask |= 1u << chan;
+                        nchan++;
                 }
-                if (!ti->formula && inside_cardioid_or_bulb(c))
+        }
+        p->f = orbit_hits(ti, p->len) * nchan;
+}
+
+/*
+ * Like save_to_hist(), but add @w instead of one.  The fraction part
+ * of @w is added as either a zero or a one, with the right odds, so the
+ * histogram stays in integers but comes out right on average.
+ */
+static void
+mh_save_to_hist(struct thread_info_t *ti, const struct mh_point_t *p,
+                double w, uint64_t rstate)
+{
+        uint32_t whole = (uint32_t)w;
+        double frac = w - whole;
+        int i;
+
+        for (i = ti->min + 1; i < p->len; i++) {
+                size_t idx;
+                int chan;
+
+                if (ti->splat == SPLAT_BILINEAR) {
+                        for (chan = 0; chan < ti->nchan; chan++) {
+                                uint32_t n = whole;
+                                if (!(p->chanmask & (1u << chan)))
+                                        continue;
+                                if (rng_to_unit(splitmix64(&rstate))
+                                    < frac) {
+                                        n++;
+                                }
+                                if (n != 0) {
+                                        splat_bilinear(ti, 1u << chan,
+                                                       ti->orbit_mh[i], n);
+                                }
+                        }
+                        continue;
+                }
+                if (!pixel_of(ti, ti->orbit_mh[i], &idx))
                         continue;
                 for (chan = 0; chan < ti->nchan; chan++) {
-                        iterate_r(c, chan, ti, false);
+                        if (p->chanmask & (1u << chan)) {
+                                uint32_t n = whole;
+                                if (rng_to_unit(splitmix64(&rstate))
+                                    < frac) {
+                                        n++;
+                                }
+                                if (n != 0)
+                                        hist_add(ti->hist, idx, n);
+                        }
+                        idx += ti->npx;
                 }
         }
-        return NULL;
 }
 
+/* Take one step of the chain, using point number @i's random numbers */
+static void
+mh_step(struct thread_info_t *ti, uint64_t i, double nudge, double wscale)
+{
+        struct mh_point_t *cur = &ti->mh, next;
+        uint64_t step[2], r[2];
+
+        rng_get(ti->seed, i, RNG_MH_STEP, step);
+        if (cur->f == 0 || rng_to_unit(step[0]) < MH_LARGE) {
+                double u, v;
+                rng_points(ti->seed, i, 1, &u, &v);
+                next.c.re = u * 3.0 - 2.0;
+                next.c.im = v * 3.0 - 1.5;
+        } else {
+                /*
+                 * Log-uniform distance, from MH_NUDGE pixels
+                 * down to a small fraction of one, in a random
+                 * direction.  Going from @next back to @cur is
+                 * exactly as likely, so it cancels out of the
+                 * acceptance ratio below.
+                 */
+                mfloat_t d, a;
+                rng_get(ti->seed, i, RNG_MH_NUDGE, r);
+                d = nudge * exp(-6.0 * rng_to_unit(r[0]));
+                a = 2.0 * M_PI * rng_to_unit(r[1]);
+                next.c.re = cur->c.re + d * cos(a);
+                next.c.im = cur->c.im + d * sin(a);
+        }
+        mh_eval(ti, &next);
+
+        /* Accept with probability min(1, f(next) / f(cur)) */
+        if (next.f != 0
+            && (cur->f == 0 || rng_to_unit(step[1]) * cur->f < next.f)) {
+                complex_t *tmp = ti->orbit_mh;
+                ti->orbit_mh = ti->orbit;
+                ti->orbit = tmp;
+                *cur = next;
+        }
+
+        /*
+         * The chain visits points in proportion to f, so
+         * weigh each visit by 1/f to get back the picture
+         * uniform sampling would have made.
+         */
+        if (cur->f != 0) {
+                rng_get(ti->seed, i, RNG_MH_ROUND, r);
+                mh_save_to_hist(ti, cur, wscale / cur->f, r[0]);
+        }
+}
+
+static void
+mh_thread(struct thread_info_t *ti)
+{
+        unsigned long niter = ti->niter;
+        mfloat_t nudge = MH_NUDGE / ti->wscale;
+        /*
+         * The scale of the weights doesn't matter, since the picture
+         * gets normalized, but it should be big enough that most of
+         * them are at least one.
+         */
+        double wscale = (double)ti->maxn * ti->nchan;
+        uint64_t first;
+        size_t j, n;
 
+        while ((n = next_batch(ti, &first)) != 0) {
+                for (j = 0; j < n; j++)
+                        mh_step(ti, first + j, nudge, wscale);
+                report_batch(ti, n, &niter);
+        }
+}
+
+/**
+ * bbrot_thread - Thread pool task for bbrot2, one per worker
+ * @arg: Pointer to a struct thread_info_t
+ */
+void
+bbrot_thread(void *arg)
+{
+        struct thread_info_t *ti = (struct thread_info_t *)arg;
+
+        if (ti->sampler == SAMPLER_MH)
+                mh_thread(ti);
+        else
+                uniform_thread(ti);
+        hist_cache_flush(ti->hist);
+}
@@ -0,0 +1,228 @@
+/*
+ * dump.c - Save bbrot2's histogram to a file, and load it back.
+ *
+ * This is what --dump and --resume use, so that a long run can be
+ * stopped and picked back up later, or added onto, or split up between
+ * machines whose dumps are added together afterward.
+ *
+ * A dump is, in the host's byte order (the magic number catches it
+ * if it isn't ours), a struct dump_hdr_t followed by the histogram, see
+ * hist_write().  Since every point is made from its number and the
+ * seed (see rng.c), the seed and the next point number are all it
+ * takes to pick up where we left off, with any number of threads.
+ *
+ * Everything in the header except @points, @seed, and @next has to
+ * match for two dumps to be added together.
+ */
+#include "bbrot2.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define DUMP_MAGIC 0x33544f5242424745ull /* "EGBBROT3" */
+
+struct dump_hdr_t {
+        uint64_t magic;
+        uint64_t points;        /* total points sampled */
+        uint64_t seed;
+        uint64_t next;          /* next point number to do */
+        uint32_t width;
+        uint32_t height;
+        uint32_t nchan;
+        uint32_t min;
+        uint32_t n[3];
+        uint32_t sampler;
+        uint32_t use_line_x;
+        uint32_t use_line_y;
+        uint32_t splat;
+        uint32_t supersample;
+        double bailout;
+        double zoom_pct;
+        double zoom_xoffs;
+        double zoom_yoffs;
+        double line_x;
+        double line_y;
+        char formula[32];
+};
+
+static void
+hdr_from_params(struct dump_hdr_t *hdr, const struct params_t *params)
+{
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->magic      = DUMP_MAGIC;
+        hdr->width      = params->width;
+        hdr->height     = params->height;
+        hdr->nchan      = params->singlechan ? 1 : 3;
+        hdr->min        = params->min;
+        hdr->n[0]       = params->n_red;
+        hdr->n[1]       = params->n_green;
+        hdr->n[2]       = params->n_blue;
+        hdr->sampler    = params->sampler;
+        hdr->use_line_x = params->use_line_x;
+        hdr->use_line_y = params->use_line_y;
+        hdr->splat      = params->splat;
+        hdr->supersample = params->supersample;
+        hdr->bailout    = params->bailout;
+        hdr->zoom_pct   = params->zoom_pct;
+        hdr->zoom_xoffs = params->zoom_xoffs;
+        hdr->zoom_yoffs = params->zoom_yoffs;
+        hdr->line_x     = params->line_x;
+        hdr->line_y     = params->line_y;
+        if (params->formula_name) {
+                strncpy(hdr->formula, params->formula_name,
+                        sizeof(hdr->formula) - 1);
+        }
+}
+
+static void
+dump_fail(const char *path, const char *why)
+{
+        fprintf(stderr, "%s: %s\n", path, why);
+        exit(EXIT_FAILURE);
+}
+
+/* Open @path and read its header into @hdr, or die trying */
+static FILE *
+dump_open(const char *path, struct dump_hdr_t *hdr)
+{
+        FILE *fp = fopen(path, "rb");
+        if (!fp)
+                dump_fail(path, strerror(errno));
+        if (fread(hdr, sizeof(*hdr), 1, fp) != 1)
+                dump_fail(path, "Not a bbrot2 dump");
+        if (hdr->magic != DUMP_MAGIC) {
+                dump_fail(path,
+                          "Not a bbrot2 dump, or not from this kind of CPU");
+        }
+        hdr->formula[sizeof(hdr->formula) - 1] = '\0';
+        return fp;
+}
+
+/**
+ * dump_write - Save the histogram and how far we got
+ * @path: File to save to.  It's written to a temporary file first and
+ *        then renamed, so an old dump there is never half overwritten.
+ * @params: Parameters of this run
+ * @hist: The histogram, with all the threads' caches flushed
+ * @next: Number of the first point not yet in @hist
+ *
+ * Return 0 if saved, -1 if not (and say why on stderr).
+ */
+int
+dump_write(const char *path, const struct params_t *params,
+           const struct hist_t *hist, uint64_t next)
+{
+        struct dump_hdr_t hdr;
+        size_t len = strlen(path);
+        char *tmp;
+        FILE *fp;
+
+        hdr_from_params(&hdr, params);
+        hdr.points = params->points_done + (next - params->first);
+        hdr.seed = params->seed;
+        hdr.next = next;
+
+        tmp = malloc(len + 5);
+        if (!tmp)
+                return -1;
+        memcpy(tmp, path, len);
+        strcpy(&tmp[len], ".tmp");
+
+        fp = fopen(tmp, "wb");
+        if (!fp)
+                goto err;
+        if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+                goto err_close;
+        if (hist_write(hist, fp) < 0)
+                goto err_close;
+        if (fclose(fp) != 0)
+                goto err;
+        if (rename(tmp, path) < 0)
+                goto err;
+        free(tmp);
+        return 0;
+
+err_close:
+        fclose(fp);
+err:
+        fprintf(stderr, "Cannot save %s: %s\n", path, strerror(errno));
+        remove(tmp);
+        free(tmp);
+        return -1;
+}
+
+/**
+ * dump_read_params - Set up @params to pick up where @path left off
+ *
+ * Everything that decides what goes into the histogram (size, number of
+ * iterations, zoom, formula...) comes from the dump, no matter what was
+ * on the command line, and so do the seed and the number of the first
+ * point to do.
+ */
+void
+dump_read_params(const char *path, struct params_t *params)
+{
+        struct dump_hdr_t hdr;
+        FILE *fp = dump_open(path, &hdr);
+
+        params->width           = hdr.width;
+        params->height          = hdr.height;
+        params->singlechan      = hdr.nchan == 1;
+        params->min             = hdr.min;
+        params->n_red           = hdr.n[0];
+        params->n_green         = hdr.n[1];
+        params->n_blue          = hdr.n[2];
+        params->sampler         = hdr.sampler;
+        params->use_line_x      = hdr.use_line_x;
+        params->use_line_y      = hdr.use_line_y;
+        params->splat           = hdr.splat;
+        params->supersample     = hdr.supersample;
+        params->bailout         = hdr.bailout;
+        params->bailsqu         = hdr.bailout * hdr.bailout;
+        params->zoom_pct        = hdr.zoom_pct;
+        params->zoom_xoffs      = hdr.zoom_xoffs;
+        params->zoom_yoffs      = hdr.zoom_yoffs;
+        params->line_x          = hdr.line_x;
+        params->line_y          = hdr.line_y;
+        params->formula         = NULL;
+        params->formula_name    = NULL;
+        if (hdr.formula[0] != '\0') {
+                const struct formula_t *f = parse_formula(hdr.formula);
+                if (!f)
+                        dump_fail(path, "Unknown formula");
+                params->formula = f->fn;
+                params->formula_name = strdup(hdr.formula);
+        }
+        params->seed            = hdr.seed;
+        params->first           = hdr.next;
+        fclose(fp);
+}
+
+/**
+ * dump_read_hist - Add @path's histogram to @hist
+ *
+ * Die if @path was made with different parameters than @params, or if
+ * it is not @params->resume[0] but has the same seed.
+ * The number of points it sampled is added to @params->points_done.
+ */
+void
+dump_read_hist(const char *path, struct params_t *params,
+               struct hist_t *hist)
+{
+        struct dump_hdr_t hdr, want;
+        FILE *fp = dump_open(path, &hdr);
+
+        hdr_from_params(&want, params);
+        want.points = hdr.points;
+        want.seed = hdr.seed;
+        want.next = hdr.next;
+        if (memcmp(&hdr, &want, sizeof(hdr)) != 0)
+                dump_fail(path, "Made with different parameters");
+        /* Same seed, same points, so we'd just be counting them twice */
+        if (path != params->resume[0] && hdr.seed == params->seed)
+                dump_fail(path, "Made with the same --seed");
+        if (hist_read_add(hist, fp) < 0)
+                dump_fail(path, "File is too short or corrupted");
+        fclose(fp);
+        params->points_done += hdr.points;
+}
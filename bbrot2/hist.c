@@ -0,0 +1,283 @@
+/*
+ * hist.c - The Buddhabrot histogram, one copy shared by every thread.
+ *
+ * Each thread used to get its own full-size histogram of unsigned
+ * longs, all of which got added up at the end.  That's nthread * nchan
+ * * 8 bytes per pixel, which for a big image on a big machine is more
+ * RAM than anybody has.  Instead, there's just one histogram, of 32-bit
+ * counters, which the threads add to with atomic operations.
+ *
+ * Atomic adds to shared memory are slow if we do one per point of every
+ * orbit, so each thread also has a small direct-mapped cache of counts
+ * (struct hist_cache_t).  A count only goes to the shared histogram when
+ * its slot is needed for a different pixel, or at the end.  Orbits
+ * spend a lot of their time going round and round the same few pixels,
+ * so this saves most of the atomic operations.
+ *
+ * A pixel can, if you ask for enough points, get more than 2^32 hits.
+ * When an add carries out of the 32-bit counter, the carry goes into a
+ * small hash table of high words on the side.  This is rare enough that
+ * the table can just use a lock.
+ */
+#include "bbrot2.h"
+#include "fractal_common.h"
+#include <stdlib.h>
+#include <string.h>
+#if EGFRACTAL_MULTITHREADED
+# include <pthread.h>
+#endif
+
+/* Initial size of the spill table, must be a power of 2 */
+#define SPILL_INIT 64
+
+struct hist_spill_t {
+        size_t idx;
+        unsigned long hi;       /* zero if this slot is unused */
+};
+
+struct hist_t {
+        uint32_t *cnt;
+        size_t size;
+        struct hist_spill_t *spill;
+        size_t nspill;
+        size_t spill_size;
+#if EGFRACTAL_MULTITHREADED
+        pthread_mutex_t lock;
+#endif
+};
+
+/**
+ * hist_create - Create an all-zero histogram
+ * @size: Number of counters, the number of pixels times the
+ *        number of channels
+ *
+ * Return the new histogram, or NULL if out of memory.
+ */
+struct hist_t *
+hist_create(size_t size)
+{
+        struct hist_t *h = malloc(sizeof(*h));
+        if (!h)
+                return NULL;
+        memset(h, 0, sizeof(*h));
+        h->size = size;
+        h->cnt = malloc(sizeof(*h->cnt) * size);
+        if (!h->cnt) {
+                free(h);
+                return NULL;
+        }
+        memset(h->cnt, 0, sizeof(*h->cnt) * size);
+#if EGFRACTAL_MULTITHREADED
+        pthread_mutex_init(&h->lock, NULL);
+#endif
+        return h;
+}
+
+void
+hist_destroy(struct hist_t *h)
+{
+#if EGFRACTAL_MULTITHREADED
+        pthread_mutex_destroy(&h->lock);
+#endif
+        free(h->spill);
+        free(h->cnt);
+        free(h);
+}
+
+static struct hist_spill_t *
+spill_find(struct hist_spill_t *tbl, size_t tblsize, size_t idx)
+{
+        size_t i = idx & (tblsize - 1);
+        while (tbl[i].hi != 0 && tbl[i].idx != idx)
+                i = (i + 1) & (tblsize - 1);
+        return &tbl[i];
+}
+
+/* Add @n to the high word of counter @idx.  Call with the lock held. */
+static void
+spill_add(struct hist_t *h, size_t idx, unsigned long n)
+{
+        struct hist_spill_t *s;
+
+        /* Keep the table no more than half full */
+        if ((h->nspill + 1) * 2 > h->spill_size) {
+                size_t i, newsize;
+                struct hist_spill_t *tbl;
+
+                newsize = h->spill_size ? h->spill_size * 2 : SPILL_INIT;
+                tbl = malloc(sizeof(*tbl) * newsize);
+                if (!tbl) {
+                        fprintf(stderr, "OOM!\n");
+                        exit(1);
+                }
+                memset(tbl, 0, sizeof(*tbl) * newsize);
+                for (i = 0; i < h->spill_size; i++) {
+                        if (h->spill[i].hi != 0) {
+                                *spill_find(tbl, newsize,
+                                            h->spill[i].idx) = h->spill[i];
+                        }
+                }
+                free(h->spill);
+                h->spill = tbl;
+                h->spill_size = newsize;
+        }
+
+        s = spill_find(h->spill, h->spill_size, idx);
+        if (s->hi == 0) {
+                s->idx = idx;
+                h->nspill++;
+        }
+        s->hi += n;
+}
+
+/* Add @n to shared counter @idx.  Safe to call from any thread. */
+static void
+hist_addn(struct hist_t *h, size_t idx, uint32_t n)
+{
+        uint32_t old = __atomic_fetch_add(&h->cnt[idx], n, __ATOMIC_RELAXED);
+        if ((uint32_t)(old + n) < old) {
+#if EGFRACTAL_MULTITHREADED
+                pthread_mutex_lock(&h->lock);
+#endif
+                spill_add(h, idx, 1);
+#if EGFRACTAL_MULTITHREADED
+                pthread_mutex_unlock(&h->lock);
+#endif
+        }
+}
+
+/**
+ * hist_get - Get the final count for counter @idx
+ *
+ * Only call this after every thread's cache has been flushed.
+ */
+unsigned long
+hist_get(const struct hist_t *h, size_t idx)
+{
+        unsigned long ret = h->cnt[idx];
+        if (h->nspill != 0) {
+                ret += spill_find(h->spill, h->spill_size, idx)->hi
+                       * ((unsigned long)UINT32_MAX + 1);
+        }
+        return ret;
+}
+
+/**
+ * hist_cache_create - Get a cache for one thread to add to @h with
+ *
+ * Return the cache, or NULL if out of memory.
+ */
+struct hist_cache_t *
+hist_cache_create(struct hist_t *h)
+{
+        struct hist_cache_t *hc = malloc(sizeof(*hc));
+        if (!hc)
+                return NULL;
+        memset(hc, 0, sizeof(*hc));
+        hc->hist = h;
+        return hc;
+}
+
+/* Move the count in @slot to the shared histogram */
+void
+hist_cache_evict(struct hist_cache_t *hc, unsigned int slot)
+{
+        hist_addn(hc->hist, hc->idx[slot], hc->n[slot]);
+        hc->n[slot] = 0;
+}
+
+/**
+ * hist_cache_flush - Move all of @hc's counts to the shared histogram
+ */
+void
+hist_cache_flush(struct hist_cache_t *hc)
+{
+        unsigned int i;
+        for (i = 0; i < HIST_CACHE_SIZE; i++) {
+                if (hc->n[i] != 0)
+                        hist_cache_evict(hc, i);
+        }
+}
+
+/**
+ * hist_cache_destroy - Flush and free @hc
+ */
+void
+hist_cache_destroy(struct hist_cache_t *hc)
+{
+        hist_cache_flush(hc);
+        free(hc);
+}
+
+/**
+ * hist_write - Write all of @h's counts to @fp
+ *
+ * The counters go first, in order, as uint32_t's, then a uint64_t
+ * number of spilled high words, then that many pairs of uint64_t
+ * counter number and high word.  Only call this while no thread is
+ * adding to @h, and after their caches have been flushed.
+ *
+ * Return 0 if okay, -1 if there was a write error.
+ */
+int
+hist_write(const struct hist_t *h, FILE *fp)
+{
+        uint64_t n = h->nspill;
+        size_t i;
+
+        if (fwrite(h->cnt, sizeof(*h->cnt), h->size, fp) != h->size)
+                return -1;
+        if (fwrite(&n, sizeof(n), 1, fp) != 1)
+                return -1;
+        for (i = 0; i < h->spill_size; i++) {
+                uint64_t pair[2];
+                if (h->spill[i].hi == 0)
+                        continue;
+                pair[0] = h->spill[i].idx;
+                pair[1] = h->spill[i].hi;
+                if (fwrite(pair, sizeof(pair), 1, fp) != 1)
+                        return -1;
+        }
+        return 0;
+}
+
+/**
+ * hist_read_add - Add counts written by hist_write() to @h
+ *
+ * Only call this while no thread is adding to @h.
+ *
+ * Return 0 if okay, -1 if the file was short or had a counter number
+ * too big for @h.
+ */
+int
+hist_read_add(struct hist_t *h, FILE *fp)
+{
+        enum { CHUNK = 16384 };
+        uint32_t buf[CHUNK];
+        uint64_t n;
+        size_t i, j;
+
+        for (i = 0; i < h->size; i += CHUNK) {
+                size_t len = h->size - i;
+                if (len > CHUNK)
+                        len = CHUNK;
+                if (fread(buf, sizeof(*buf), len, fp) != len)
+                        return -1;
+                for (j = 0; j < len; j++) {
+                        if (buf[j] != 0)
+                                hist_addn(h, i + j, buf[j]);
+                }
+        }
+
+        if (fread(&n, sizeof(n), 1, fp) != 1)
+                return -1;
+        while (n-- > 0) {
+                uint64_t pair[2];
+                if (fread(pair, sizeof(pair), 1, fp) != 1)
+                        return -1;
+                if (pair[0] >= h->size)
+                        return -1;
+                spill_add(h, pair[0], pair[1]);
+        }
+        return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * lanes.c - Lane-parallel orbits for bbrot2.
+ *
+ * Like lib/escape.c, but for paths instead of pixels: several values
+ * of c are iterated at once in SIMD lanes, and whenever a lane's path
+ * is done, the lane gets the next c.  Only for plain z^2+c; the other
+ * formulas still go through orbit_iterate() one at a time.
+ *
+ * The lanes don't know how long their paths will be until they
+ * escape, so every step of every lane goes into a ring buffer, one row
+ * per step with a column for each lane.  That's a couple of vector
+ * stores per step instead of one store per lane.  When a path escapes,
+ * lanes_splat() picks it back out of its column and adds it to the
+ * histogram.  The ring only has to be as long as the longest possible
+ * path.
+ *
+ * The lanes' state stays in struct lanes_t between calls, so that
+ * lanes_run() can be fed a batch of points at a time without having
+ * to stop and wait for the slowest path of each batch.
+ */
+#include "bbrot2.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define LANES_X86_DISPATCH 1
+#else
+# define LANES_X86_DISPATCH 0
+#endif
+
+/* Generic build, whatever the compiler's baseline is (SSE2 on x86-64) */
+#define KERNEL lanes_run_generic
+#define NLANE 4
+#include "lanes_kernel.h"
+
+#if LANES_X86_DISPATCH
+# pragma GCC push_options
+# pragma GCC target("avx2")
+# define KERNEL lanes_run_avx2
+# define NLANE 4
+# include "lanes_kernel.h"
+# pragma GCC pop_options
+
+# pragma GCC push_options
+# pragma GCC target("avx512f")
+# define KERNEL lanes_run_avx512
+# define NLANE 8
+# include "lanes_kernel.h"
+# pragma GCC pop_options
+#endif /* LANES_X86_DISPATCH */
+
+typedef void (*lanes_fn_t)(struct lanes_t *, struct thread_info_t *,
+                           const complex_t *, size_t, bool);
+
+struct lanes_isa_t {
+        const char *name;
+        lanes_fn_t fn;
+        int nlane;
+};
+
+static const struct lanes_isa_t *
+lanes_isa(void)
+{
+        static const struct lanes_isa_t GENERIC = {
+                "generic", lanes_run_generic, 4
+        };
+#if LANES_X86_DISPATCH
+        static const struct lanes_isa_t AVX2 = {
+                "avx2", lanes_run_avx2, 4
+        };
+        static const struct lanes_isa_t AVX512 = {
+                "avx512f", lanes_run_avx512, 8
+        };
+#endif
+        static const struct lanes_isa_t *isa = NULL;
+
+        /* Racy, but every thread would come up with the same answer */
+        if (isa != NULL)
+                return isa;
+
+        isa = &GENERIC;
+#if LANES_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+                isa = &AVX512;
+        else if (__builtin_cpu_supports("avx2"))
+                isa = &AVX2;
+#endif
+        return isa;
+}
+
+/**
+ * lanes_isa_name - Name of the instruction set lanes_run() will use
+ */
+const char *
+lanes_isa_name(void)
+{
+        return lanes_isa()->name;
+}
+
+/**
+ * lanes_create - Get a set of empty lanes
+ * @maxn: Longest path there can be
+ *
+ * Return the lanes, or NULL if out of memory.
+ */
+struct lanes_t *
+lanes_create(int maxn)
+{
+        struct lanes_t *ln;
+        size_t ring = 1;
+        int nlane = lanes_isa()->nlane;
+
+        while (ring < maxn)
+                ring *= 2;
+
+        ln = malloc(sizeof(*ln));
+        if (!ln)
+                return NULL;
+        memset(ln, 0, sizeof(*ln));
+        ln->mask = ring - 1;
+        ln->re = malloc(sizeof(*ln->re) * ring * nlane);
+        ln->im = malloc(sizeof(*ln->im) * ring * nlane);
+        if (!ln->re || !ln->im) {
+                lanes_destroy(ln);
+                return NULL;
+        }
+        return ln;
+}
+
+void
+lanes_destroy(struct lanes_t *ln)
+{
+        free(ln->re);
+        free(ln->im);
+        free(ln);
+}
+
+/**
+ * lanes_run - Trace a batch of paths into @ti's histogram
+ * @ln: Lanes from lanes_create()
+ * @ti: Thread's info
+ * @c: Array of values of c to trace, already weeded out by
+ *     inside_cardioid_or_bulb() and the prefilter
+ * @nc: Length of @c
+ * @drain: False to return as soon as the lanes run out of paths, with
+ *         the last few still in progress, to be finished on the next
+ *         call.  True to finish them all before returning.
+ *
+ * The histogram counts come out exactly the same as iterate_r()'s for
+ * each c in turn.
+ */
+void
+lanes_run(struct lanes_t *ln, struct thread_info_t *ti,
+          const complex_t *c, size_t nc, bool drain)
+{
+        lanes_isa()->fn(ln, ti, c, nc, drain);
+}
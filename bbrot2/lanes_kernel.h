@@ -0,0 +1,185 @@
+/*
+ * lanes_kernel.h - Body of bbrot2's lane-parallel orbit iterator.
+ *
+ * This is not a normal header.  lanes.c includes it once for every
+ * instruction set it supports, after defining:
+ *
+ *   KERNEL     name of the function to define
+ *   NLANE      number of orbits iterated at once
+ *
+ * and after setting the target with "#pragma GCC target" if need be.
+ * See lib/escape_kernel.h, which this is patterned after.
+ */
+#if !defined(KERNEL) || !defined(NLANE)
+# error "Define KERNEL and NLANE before including lanes_kernel.h"
+#endif
+
+static void
+KERNEL(struct lanes_t *ln, struct thread_info_t *ti,
+       const complex_t *c, size_t nc, bool drain)
+{
+        typedef mfloat_t vfloat_t
+                __attribute__((vector_size(NLANE * sizeof(mfloat_t))));
+        typedef long long vint_t
+                __attribute__((vector_size(NLANE * sizeof(long long))));
+
+        /* zr, zi, as of iteration number @save, for periodicity check */
+        vfloat_t sr, si;
+        vint_t save;
+        vfloat_t zr, zi, cr, ci, bail, two, eps2;
+        vint_t it, vn, live;
+        mfloat_t *rre = ln->re, *rim = ln->im;
+        size_t mask = ln->mask;
+        uint64_t t = ln->t;
+        size_t next = 0;
+        unsigned long nperiodic = 0;
+        unsigned long niter = 0;
+        int nlive = 0;
+        int l;
+
+        for (l = 0; l < NLANE; l++) {
+                bail[l] = ti->bailsqu;
+                two[l]  = 2.0;
+                vn[l]   = ti->maxn;
+                eps2[l] = ti->period_eps * ti->period_eps;
+
+                /* Pick up where the last call left off... */
+                zr[l]   = ln->zr[l];
+                zi[l]   = ln->zi[l];
+                cr[l]   = ln->cr[l];
+                ci[l]   = ln->ci[l];
+                sr[l]   = ln->sr[l];
+                si[l]   = ln->si[l];
+                it[l]   = ln->it[l];
+                save[l] = ln->save[l];
+                live[l] = ln->live[l] ? -1 : 0;
+
+                /* ...and put new orbits in any lanes that finished */
+                if (!live[l] && next < nc) {
+                        cr[l]   = c[next].re;
+                        ci[l]   = c[next].im;
+                        zr[l]   = zi[l] = sr[l] = si[l] = 0.0;
+                        it[l]   = 0;
+                        save[l] = 1;
+                        live[l] = -1;
+                        next++;
+                }
+                if (live[l])
+                        nlive++;
+        }
+
+        /*
+         * Lanes only go empty when we're out of new orbits.  Unless
+         * we're told to finish the ones in the lanes, go back for
+         * more then, rather than let the lanes sit empty.
+         */
+        while (nlive == NLANE || (drain && nlive > 0)) {
+                vfloat_t zr2 = zr * zr;
+                vfloat_t zi2 = zi * zi;
+                /*
+                 * Same order of operations as complex_sq() and
+                 * complex_add(), so the paths come out exactly the
+                 * same as orbit_iterate()'s.
+                 */
+                vfloat_t tr = zr2 - zi2 + cr;
+                vfloat_t ti_ = two * zi * zr + ci;
+                vfloat_t dr = tr - sr;
+                vfloat_t di = ti_ - si;
+                vint_t done, inside, escaped, periodic, saving;
+                size_t k = (t & mask) * NLANE;
+                int any;
+
+                /* Every lane's path goes into the ring buffer */
+                memcpy(&rre[k], &tr, sizeof(tr));
+                memcpy(&rim[k], &ti_, sizeof(ti_));
+
+                inside = it == vn;
+                escaped = ((tr * tr + ti_ * ti_) >= bail)
+                          | ((tr == zr) & (ti_ == zi));
+                escaped &= ~inside;
+                periodic = ((dr * dr + di * di) < eps2) & ~escaped & ~inside;
+                done = (inside | escaped | periodic) & live;
+
+                /*
+                 * Step every lane along, finished or not.  Brent's
+                 * method: save z every time the iteration count hits
+                 * a power of two.
+                 */
+                saving = it == save;
+                sr = (vfloat_t)(((vint_t)tr & saving)
+                                | ((vint_t)sr & ~saving));
+                si = (vfloat_t)(((vint_t)ti_ & saving)
+                                | ((vint_t)si & ~saving));
+                save += save & saving;
+                zr = tr;
+                zi = ti_;
+                it += 1;
+
+                any = 0;
+                for (l = 0; l < NLANE; l++)
+                        any |= done[l] != 0;
+                if (!any) {
+                        t++;
+                        continue;
+                }
+
+                /*
+                 * Slow path: at least one lane finished.  Splat its
+                 * path if it escaped, and start the lane over with the
+                 * next orbit.  It's usually just one lane, and most
+                 * paths are short, so this is worth keeping quick.
+                 */
+                for (l = 0; l < NLANE; l++) {
+                        long long n;
+
+                        if (!done[l])
+                                continue;
+                        n = it[l] - 1;  /* it, before the step above */
+                        if (inside[l]) {
+                                niter += n;
+                        } else {
+                                niter += n + 1;
+                                if (periodic[l]) {
+                                        nperiodic++;
+                                } else {
+                                        lanes_splat(ti, &rre[l], &rim[l],
+                                                    NLANE, t - n, mask,
+                                                    n + 1);
+                                }
+                        }
+
+                        if (next < nc) {
+                                cr[l]   = c[next].re;
+                                ci[l]   = c[next].im;
+                                next++;
+                        } else {
+                                /* Dead lane, just spins on zero */
+                                cr[l]   = ci[l] = 0.0;
+                                live[l] = 0;
+                                nlive--;
+                        }
+                        zr[l]   = zi[l] = sr[l] = si[l] = 0.0;
+                        it[l]   = 0;
+                        save[l] = 1;
+                }
+                t++;
+        }
+
+        for (l = 0; l < NLANE; l++) {
+                ln->zr[l]   = zr[l];
+                ln->zi[l]   = zi[l];
+                ln->cr[l]   = cr[l];
+                ln->ci[l]   = ci[l];
+                ln->sr[l]   = sr[l];
+                ln->si[l]   = si[l];
+                ln->it[l]   = it[l];
+                ln->save[l] = save[l];
+                ln->live[l] = live[l] != 0;
+        }
+        ln->t = t;
+        ti->nperiodic += nperiodic;
+        ti->niter += niter;
+}
+
+#undef KERNEL
+#undef NLANE
@@ -97,6 +97,10 @@
  * Cygwin? macOS?), it's theoretically slower due to the overhead of
  * additional context switching.
  *
+ * All the threads add to one histogram, with 32-bit counters, instead
+ * of each having their own.  Otherwise, big pictures on machines with
+ * a lot of cores need more RAM than anybody has.  See hist.c.
+ *
  * Wanted Optimizations:
  * ---------------------
  *
@@ -104,8 +108,10 @@
  *
  * 2. If there's a fast way to tell if a sample is just next to, but
  *    outside, the Mandelbrot set, then you wouldn't have the problem of
- *    having to run close-to-max iterations twice.  But I don't know any
- *    such optimization.
+ *    having to run close-to-max iterations just to find out.  But I
+ *    don't know any such optimization.  (At least we no longer run
+ *    them twice; the path is saved the first time and replayed into
+ *    the histogram.)
  *
  * 3. I also don't know any cheats like the cardioid check for formulas
  *    other than z^2+c.  This is unfortunate, since you can get some really
@@ -125,40 +131,8 @@
 #include <time.h>
 #include <getopt.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/mman.h>
-#ifndef EGFRACTAL_MULTITHREADED
-# define EGFRACTAL_MULTITHREADED 0
-#else
-# include <pthread.h>
-#endif
-
-struct params_t {
-        int n_red;
-        int n_green;
-        int n_blue;
-        int height;
-        int width;
-        int min;
-        int nthread;
-        mfloat_t bailout;
-        mfloat_t bailsqu;
-        mfloat_t line_y;
-        mfloat_t line_x;
-        double eq_exp;
-        double rmout_scale;
-        unsigned long points;
-        bool singlechan;
-        bool do_hist;
-        bool verbose;
-        bool use_line_y;
-        bool use_line_x;
-        bool negate;
-        bool rmout;
-        bool linked;
-        complex_t (*formula)(complex_t, complex_t);
-        const char *overlay;
-};
-
 /* Error helpers */
 static void
 oom(void)
@@ -174,245 +148,376 @@ bad_arg(const char *type, const char *optarg)
         exit(EXIT_FAILURE);
 }
 
-static void
-initialize_seeds(unsigned short seeds[6])
+/* A seed for when there's no --seed, different every time */
+static uint64_t
+default_seed(void)
 {
-        clock_t c, tmp;
-        time_t t = time(NULL);
-        /*
-         * At the cost of likely a microsecond,
-         * ensure the ticks have changed, so that
-         * seeds are different for every call to
-         * this function.
-         */
-        c = tmp = clock();
-        while (c == tmp)
-                c = clock();
-        seeds[0] = seeds[3] = t & 0xffffu;
-        seeds[1] = seeds[4] = (t >> 16) & 0xffffu;
-        /*
-         * These need to be different to converge x from y,
-         * or else x == y always, and we are only ever sampling
-         * the diagonal line.  This makes for a trippy picture,
-         * but not the one we're looking for.
-         */
-        seeds[2] = (unsigned short)c;
-        seeds[5] = (unsigned short)c + 1;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec)
+               ^ ((uint64_t)getpid() << 40);
 }
 
-#if EGFRACTAL_MULTITHREADED
-
-/* XXX Place up at top of file */
-struct thread_helper_t {
-        pthread_t *id;
-        pthread_attr_t attr;
-};
-
-static void
-init_thread_helper(struct thread_helper_t *helper, int nthread)
+/* Return true if @params zooms or pans away from the whole set */
+static bool
+zoomed_in(const struct params_t *params)
 {
-        helper->id = malloc(sizeof(*helper->id) * nthread);
-        if (!helper->id)
-                oom();
-        if (pthread_attr_init(&helper->attr) != 0) {
-                perror("pthread_attr_init error");
-                exit(EXIT_FAILURE);
-        }
+        return params->zoom_pct != 0.75
+               || params->zoom_xoffs != 0.5
+               || params->zoom_yoffs != 0.0;
 }
 
-static void
-join_threads(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int nthread)
+/*
+ * Fill in the prefilter grid, using the already set up @ti to iterate
+ * with.  Return it, or NULL if we're not using one.
+ */
+static struct prefilter_t *
+bbrot2_prefilter(struct params_t *params, struct threadpool_t *pool,
+                 struct thread_info_t *ti, int nthread)
 {
+        enum { N = PREFILTER_SIZE };
+        struct prefilter_t *pf;
+        unsigned long niter;
+        double frac;
         int i;
-        int res = pthread_attr_destroy(&helper->attr);
-        if (res != 0) {
-                perror("pthread_attr_destroy error");
-                exit(EXIT_FAILURE);
-        }
-        for (i = 0; i < nthread; i++) {
-                void *s;
-                res = pthread_join(helper->id[i], &s);
-                if (res != 0 || s != NULL) {
-                        fprintf(stderr, "pthread_join[%d] failed (%s)\n",
-                                i, strerror(errno));
-                        fprintf(stderr, "Continuing anyway\n");
-                }
-        }
 
-}
+        if (!params->prefilter || !zoomed_in(params))
+                return NULL;
 
-static void
-create_thread(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int threadno)
-{
-        int res = pthread_create(&helper->id[threadno],
-                        &helper->attr, &bbrot_thread, &ti[threadno]);
-        if (res != 0) {
-                perror("pthread_create error");
-                exit(EXIT_FAILURE);
-        }
-}
-
-static void
-free_thread_helper(struct thread_helper_t *helper)
-{
-        free(helper->id);
-}
+        pf = malloc(sizeof(*pf));
+        if (!pf)
+                oom();
+        pf->ok = malloc(N * N);
+        pf->ok_tmp = malloc(N * N);
+        if (!pf->ok || !pf->ok_tmp)
+                oom();
+        tileq_init(&pf->tileq, N, N);
 
-#else /* !EGFRACTAL_MULTITHREADED */
+        for (i = 0; i < nthread; i++) {
+                ti[i].prefilter = pf;
+                if (threadpool_submit(pool, prefilter_thread, &ti[i]) < 0)
+                        oom();
+        }
+        threadpool_wait(pool);
 
-struct thread_helper_t {
-        int dummy;
-};
+        /* Don't count these toward the main run's stats */
+        niter = 0;
+        for (i = 0; i < nthread; i++) {
+                niter += ti[i].niter;
+                ti[i].niter = 0;
+                ti[i].nperiodic = 0;
+        }
 
-static void
-init_thread_helper(struct thread_helper_t *helper, int nthread)
-{
-#warning Remove
-printf("Not multithreaded\n");
-        return;
+        frac = prefilter_dilate(pf);
+        if (params->verbose) {
+                printf("Prefilter: %.1f%% of points can reach the picture"
+                       " (%lu iterations to find out)\n",
+                       100.0 * frac, niter);
+        }
+        return pf;
 }
 
-static void
-join_threads(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int nthread)
-{
-        /* Only one thread, so call it directly */
-        bbrot_thread(&ti[0]);
-}
+static struct stop_t stop;
 
 static void
-create_thread(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int threadno)
+stop_handler(int sig)
 {
-        return;
+        if (sig == SIGALRM)
+                stop.checkpoint = 1;
+        else
+                stop.quit = 1;
 }
 
+/*
+ * Have SIGINT and SIGTERM stop the threads so we can save a dump, and
+ * set a timer to save one every @every seconds
+ */
 static void
-free_thread_helper(struct thread_helper_t *helper)
+catch_signals(unsigned int every)
 {
-        return;
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stop_handler;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        sigaction(SIGALRM, &sa, NULL);
+        if (every)
+                alarm(every);
 }
 
-#endif /* !EGFRACTAL_MULTITHREADED */
-
 static void
-bbrot2_get_data(struct params_t *params, unsigned long *sumbuf,
-                int nchan, int npx)
+bbrot2_get_data(struct params_t *params, struct threadpool_t *pool,
+                struct hist_t *hist, int nchan, int npx)
 {
         struct thread_info_t *ti;
-        struct thread_helper_t helper;
-        int nthread = params->nthread;
-        size_t bufsize = sizeof(unsigned long) * npx * nchan;
-        int i;
+        struct prefilter_t *pf;
+        struct progress_t progress;
+        struct pointq_t pointq;
+        int nthread = threadpool_size(pool);
+        unsigned long nperiodic;
+        mfloat_t zoom4 = 4.0 * params->zoom_pct;
+        int ss = params->supersample;
+        int i, maxn;
 
         ti = malloc(sizeof(*ti) * nthread);
         if (!ti)
                 oom();
 
-        init_thread_helper(&helper, nthread);
+        maxn = params->n_red;
+        if (nchan > 1) {
+                if (maxn < params->n_green)
+                        maxn = params->n_green;
+                if (maxn < params->n_blue)
+                        maxn = params->n_blue;
+        }
 
         for (i = 0; i < nthread; i++) {
-                unsigned long *chanbase = malloc(bufsize);
-                if (!chanbase)
-                        oom();
-                memset(chanbase, 0, bufsize);
-
-                /* XXX This assumes points is a multiple of nthread */
-                ti[i].points            = params->points / nthread;
-                ti[i].width             = params->width;
-                ti[i].height            = params->height;
+                ti[i].width             = params->width * ss;
+                ti[i].height            = params->height * ss;
                 ti[i].nchan             = nchan;
                 ti[i].min               = params->min;
                 ti[i].n[0]              = params->n_red;
                 ti[i].n[1]              = params->n_green;
                 ti[i].n[2]              = params->n_blue;
-                ti[i]._chanbuf_base     = chanbase;
-                ti[i].chanbuf[0]        = &chanbase[0];
-                ti[i].chanbuf[1]        = &chanbase[npx];
-                ti[i].chanbuf[2]        = &chanbase[npx * 2];
-                ti[i].wthird            = params->width / 3.0;
-                ti[i].hthird            = params->height / 3.0;
+                ti[i].maxn              = maxn;
+                ti[i].npx               = npx;
+                ti[i].hist              = hist_cache_create(hist);
+                if (!ti[i].hist)
+                        oom();
+                /* Same as mbrot2's -x, -y, and -z */
+                ti[i].re0               = -params->zoom_xoffs
+                                          - 2.0 * params->zoom_pct;
+                ti[i].im0               = -params->zoom_yoffs
+                                          - 2.0 * params->zoom_pct;
+                /*
+                 * With --supersample, center each ss x ss block of
+                 * cells on its pixel, not its first cell on it
+                 */
+                ti[i].re0               -= (ss - 1) * zoom4
+                                           / (2.0 * ti[i].width);
+                ti[i].im0               -= (ss - 1) * zoom4
+                                           / (2.0 * ti[i].height);
+                ti[i].wscale            = ti[i].width / zoom4;
+                ti[i].hscale            = ti[i].height / zoom4;
                 ti[i].bailsqu           = params->bailsqu;
+                ti[i].period_eps        = period_eps(
+                                fmin(zoom4 / params->width,
+                                     zoom4 / params->height));
+                ti[i].nperiodic         = 0;
+                ti[i].niter             = 0;
+                ti[i].orbit             = malloc(sizeof(complex_t) * maxn);
+                ti[i].orbit_mh          = malloc(sizeof(complex_t) * maxn);
+                if (!ti[i].orbit || !ti[i].orbit_mh)
+                        oom();
+                ti[i].sampler           = params->sampler;
+                ti[i].splat             = params->splat;
+                ti[i].prefilter         = NULL;
+                ti[i].lanes             = NULL;
+                if (params->simd && !params->formula
+                    && params->sampler == SAMPLER_UNIFORM) {
+                        ti[i].lanes = lanes_create(maxn);
+                        if (!ti[i].lanes)
+                                oom();
+                }
                 ti[i].formula           = params->formula;
                 ti[i].line_x            = params->line_x;
                 ti[i].line_y            = params->line_y;
                 ti[i].use_line_x        = params->use_line_x;
                 ti[i].use_line_y        = params->use_line_y;
-                /*
-                 * This initializes to different
-                 * values for each set of seeds.
-                 */
-                initialize_seeds(ti[i].seeds);
+                ti[i].mh.f              = 0;
+                ti[i].stop              = &stop;
+                ti[i].seed              = params->seed;
+                ti[i].pointq            = &pointq;
+        }
+        pointq.next = params->first;
+        pointq.end  = params->first + params->points;
 
-                create_thread(&helper, ti, i);
+        pf = bbrot2_prefilter(params, pool, ti, nthread);
+
+        if (params->verbose) {
+                progress_init(&progress, "points", params->points);
+                for (i = 0; i < nthread; i++)
+                        ti[i].progress = &progress;
+        } else {
+                for (i = 0; i < nthread; i++)
+                        ti[i].progress = NULL;
         }
+        if (params->dump)
+                catch_signals(params->dump_every);
 
-        join_threads(&helper, ti, nthread);
+        /*
+         * The threads only return early if they've been asked to
+         * save a checkpoint (or to save and quit), in which case we
+         * send them right back to where they left off.
+         */
+        for (;;) {
+                for (i = 0; i < nthread; i++) {
+                        if (threadpool_submit(pool, bbrot_thread, &ti[i]) < 0)
+                                oom();
+                }
+                threadpool_wait(pool);
+
+                if (!stop.quit && !stop.checkpoint)
+                        break;
+                stop.checkpoint = 0;
+                if (pointq.next > pointq.end)
+                        pointq.next = pointq.end;
+                dump_write(params->dump, params, hist, pointq.next);
+                if (stop.quit) {
+                        printf("\nSaved to %s.  Use --resume to pick up "
+                               "where this left off.\n", params->dump);
+                        exit(EXIT_FAILURE);
+                }
+                if (params->dump_every)
+                        alarm(params->dump_every);
+        }
+        if (params->verbose)
+                progress_done(&progress);
+        if (params->dump)
+                dump_write(params->dump, params, hist, pointq.end);
 
         /*
-         * Sum the threads' results together.
-         * They SHOULD have received different
-         * rand() seeds, so the buffers SHOULD
-         * all be different.
+         * The threads have all added their counts to @hist
+         * already, so all that's left is their other stats.
          */
-        memset(sumbuf, 0, bufsize);
+        nperiodic = 0;
         for (i = 0; i < nthread; i++) {
-                int j;
-                unsigned long *chanbase = ti[i]._chanbuf_base;
-                for (j = 0; j < npx * nchan; j++)
-                        sumbuf[j] += chanbase[j];
-                free(ti[i]._chanbuf_base);
+                hist_cache_destroy(ti[i].hist);
+                if (ti[i].lanes)
+                        lanes_destroy(ti[i].lanes);
+                free(ti[i].orbit);
+                free(ti[i].orbit_mh);
+                nperiodic += ti[i].nperiodic;
+        }
+        if (params->verbose) {
+                printf("Periodicity check caught %lu orbits\n",
+                       nperiodic);
+        }
+        if (pf) {
+                free(pf->ok);
+                free(pf->ok_tmp);
+                free(pf);
         }
-        free_thread_helper(&helper);
         free(ti);
 }
 
-static void
-bbrot2(Pxbuf *pxbuf, struct params_t *params)
-{
-        int npx, nchan, i, row, col;
-        unsigned long *sumbuf;
-        /* Pointers into sumbuf, for convenience */
-        unsigned long *chanbuf[3];
+struct fill_info_t {
+        struct tileq_t *tileq;
+        const struct hist_t *hist;
+        Pxbuf *pxbuf;
+        int nchan;
+        int npx;        /* cells in one channel of the histogram */
+        int ss;         /* --supersample */
+};
 
-        nchan = params->singlechan ? 1 : 3;
-        npx = params->width * params->height;
-        sumbuf = malloc(sizeof(*sumbuf) * npx * nchan);
-        if (!sumbuf)
-                oom();
+/*
+ * Add up the --supersample x --supersample block of histogram cells
+ * that make up pixel (@row, @col) of channel @chan
+ */
+static unsigned long
+fill_sum(const struct fill_info_t *fi, int chan, int row, int col)
+{
+        int ss = fi->ss;
+        size_t hwidth = (size_t)fi->tileq->width * ss;
+        size_t base = (size_t)chan * fi->npx
+                      + (size_t)row * ss * hwidth + (size_t)col * ss;
+        unsigned long sum = 0;
+        int r, c;
+
+        for (r = 0; r < ss; r++) {
+                for (c = 0; c < ss; c++)
+                        sum += hist_get(fi->hist, base + r * hwidth + c);
+        }
+        return sum;
+}
 
-        bbrot2_get_data(params, sumbuf, nchan, npx);
+/* Thread pool task to copy tiles of the histogram into the image */
+static void
+fill_thread(void *arg)
+{
+        struct fill_info_t *fi = arg;
+        struct tile_t tile;
+
+        while (tileq_next(fi->tileq, &tile)) {
+                int row, col;
+                for (row = tile.rowstart; row < tile.rowend; row++) {
+                        for (col = tile.colstart; col < tile.colend; col++) {
+                                unsigned long r, g, b;
+                                struct pixel_t px;
+
+                                r = fill_sum(fi, 0, row, col);
+                                if (fi->nchan > 1) {
+                                        g = fill_sum(fi, 1, row, col);
+                                        b = fill_sum(fi, 2, row, col);
+                                } else {
+                                        g = b = r;
+                                }
 
-        for (i = 0; i < nchan; i++)
-                chanbuf[i] = &sumbuf[npx * i];
+                                px.x[PXBUF_RED]        = (float)r;
+                                px.x[PXBUF_GREEN]      = (float)g;
+                                px.x[PXBUF_BLUE]       = (float)b;
 
-        /* Fill each pixel in pixelbuf */
-        i = 0;
-        for (row = 0; row < params->height; row++) {
-                for (col = 0; col < params->width; col++) {
-                        unsigned int r, g, b;
-                        struct pixel_t px;
-                        r = chanbuf[0][i];
-                        if (nchan > 1) {
-                                g = chanbuf[1][i];
-                                b = chanbuf[2][i];
-                        } else {
-                                g = b = r;
+                                pxbuf_set_pixel(fi->pxbuf, &px, row, col);
                         }
-                        i++;
+                }
+        }
+}
 
-                        px.x[PXBUF_RED]        = (float)r;
-                        px.x[PXBUF_GREEN]      = (float)g;
-                        px.x[PXBUF_BLUE]       = (float)b;
+static void
+bbrot2(Pxbuf *pxbuf, struct params_t *params, struct threadpool_t *pool)
+{
+        int npx, nchan, nthread, i;
+        struct hist_t *hist;
+        struct tileq_t tileq;
+        struct fill_info_t fi;
 
-                        pxbuf_set_pixel(pxbuf, &px, row, col);
+        nchan = params->singlechan ? 1 : 3;
+        if ((double)params->width * params->height * params->supersample
+            * params->supersample > INT_MAX) {
+                fprintf(stderr, "Image is too big\n");
+                exit(EXIT_FAILURE);
+        }
+        npx = params->width * params->height
+              * params->supersample * params->supersample;
+        hist = hist_create((size_t)npx * nchan);
+        if (!hist)
+                oom();
+        for (i = 0; i < params->nresume; i++)
+                dump_read_hist(params->resume[i], params, hist);
+        if (params->verbose && params->nresume) {
+                printf("Resuming with %lu points already sampled\n",
+                       params->points_done);
+        }
+
+        nthread = threadpool_size(pool);
+        if (params->verbose) {
+                printf("Using %d threads, --seed=%llu\n", nthread,
+                       (unsigned long long)params->seed);
+                if (params->simd && !params->formula
+                    && params->sampler == SAMPLER_UNIFORM) {
+                        printf("Using %s orbit kernel\n", lanes_isa_name());
                 }
+        }
 
+        bbrot2_get_data(params, pool, hist, nchan, npx);
+
+        /* Fill each pixel in pixelbuf */
+        tileq_init(&tileq, params->width, params->height);
+        fi.tileq = &tileq;
+        fi.hist  = hist;
+        fi.pxbuf = pxbuf;
+        fi.nchan = nchan;
+        fi.npx   = npx;
+        fi.ss    = params->supersample;
+        for (i = 0; i < nthread; i++) {
+                if (threadpool_submit(pool, fill_thread, &fi) < 0)
+                        oom();
         }
+        threadpool_wait(pool);
 
-        free(sumbuf);
+        hist_destroy(hist);
 }
 
 static const char *
@@ -428,13 +533,27 @@ parse_args(int argc, char **argv, struct params_t *params)
                 { "rmout",          optional_argument, NULL, 6 },
                 { "nthread",        required_argument, NULL, 7 },
                 { "overlay",        required_argument, NULL, 8 },
+                { "affinity",       no_argument,       NULL, 9 },
+                { "sampler",        required_argument, NULL, 10 },
+                { "no-prefilter",   no_argument,       NULL, 11 },
+                { "dump",           required_argument, NULL, 12 },
+                { "dump-every",     required_argument, NULL, 13 },
+                { "resume",         required_argument, NULL, 14 },
+                { "seed",           required_argument, NULL, 15 },
+                { "no-simd",        no_argument,       NULL, 16 },
+                { "splat",          required_argument, NULL, 17 },
+                { "supersample",    required_argument, NULL, 18 },
+                { "depth",          required_argument, NULL, 19 },
+                { "x-offs",         required_argument, NULL, 'x' },
+                { "y-offs",         required_argument, NULL, 'y' },
+                { "zoom-pct",       required_argument, NULL, 'z' },
                 { "linked",         no_argument,       NULL, 'l' },
                 { "verbose",        no_argument,       NULL, 'v' },
                 { "bailout",        required_argument, NULL, 'b' },
                 { "help",           no_argument,       NULL, '?' },
                 { NULL,             0,                 NULL, 0 },
         };
-        static const char *optstr = "B:b:g:h:m:o:p:r:svw:";
+        static const char *optstr = "B:b:g:h:m:o:p:r:svw:x:y:z:";
         const char *outfile = "bbrot2.bmp";
 
         /* Set to initial values */
@@ -445,7 +564,26 @@ parse_args(int argc, char **argv, struct params_t *params)
         params->width      = 600;
         params->min        = 3;
         params->linked     = false;
-        params->nthread    = 4;
+        params->nthread    = 0;
+        params->affinity   = false;
+        params->sampler    = SAMPLER_UNIFORM;
+        params->prefilter  = true;
+        params->formula_name = NULL;
+        params->dump       = NULL;
+        params->dump_every = 600;
+        params->resume     = NULL;
+        params->nresume    = 0;
+        params->points_done = 0;
+        params->seed       = default_seed();
+        params->first      = 0;
+        params->simd       = true;
+        params->splat      = SPLAT_NEAREST;
+        params->supersample = 1;
+        params->depth      = 8;
+        /* The whole set, [-2:1] x [-1.5:1.5] */
+        params->zoom_pct   = 0.75;
+        params->zoom_xoffs = 0.5;
+        params->zoom_yoffs = 0.0;
         params->bailsqu    = 4.0;
         params->bailout    = 2.0;
         params->points     = 500000;
@@ -504,6 +642,7 @@ parse_args(int argc, char **argv, struct params_t *params)
                         if (f == NULL)
                                 bad_arg("--formula", optarg);
                         params->formula = f->fn;
+                        params->formula_name = optarg;
                         break;
                     }
                 case 6:
@@ -527,6 +666,66 @@ parse_args(int argc, char **argv, struct params_t *params)
                 case 8:
                         params->overlay = optarg;
                         break;
+                case 9:
+                        params->affinity = true;
+                        break;
+                case 10:
+                        if (!strcmp(optarg, "uniform"))
+                                params->sampler = SAMPLER_UNIFORM;
+                        else if (!strcmp(optarg, "mh"))
+                                params->sampler = SAMPLER_MH;
+                        else
+                                bad_arg("--sampler", optarg);
+                        break;
+                case 11:
+                        params->prefilter = false;
+                        break;
+                case 12:
+                        params->dump = optarg;
+                        break;
+                case 13:
+                        params->dump_every = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg)
+                                bad_arg("--dump-every", optarg);
+                        break;
+                case 14:
+                        params->resume = realloc(params->resume,
+                                        sizeof(*params->resume)
+                                        * (params->nresume + 1));
+                        if (!params->resume)
+                                oom();
+                        params->resume[params->nresume++] = optarg;
+                        break;
+                case 15:
+                        params->seed = strtoull(optarg, &endptr, 0);
+                        if (endptr == optarg)
+                                bad_arg("--seed", optarg);
+                        break;
+                case 16:
+                        params->simd = false;
+                        break;
+                case 17:
+                        if (!strcmp(optarg, "nearest"))
+                                params->splat = SPLAT_NEAREST;
+                        else if (!strcmp(optarg, "bilinear"))
+                                params->splat = SPLAT_BILINEAR;
+                        else
+                                bad_arg("--splat", optarg);
+                        break;
+                case 18:
+                        params->supersample = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg || params->supersample < 1
+                            || params->supersample > 8) {
+                                bad_arg("--supersample", optarg);
+                        }
+                        break;
+                case 19:
+                        params->depth = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg || *endptr != '\0'
+                            || (params->depth != 8 && params->depth != 16)) {
+                                bad_arg("--depth", optarg);
+                        }
+                        break;
                 case 'B':
                         params->bailout = strtold(optarg, &endptr);
                         if (endptr == optarg)
@@ -580,6 +779,21 @@ parse_args(int argc, char **argv, struct params_t *params)
                         if (endptr == optarg)
                                 bad_arg("-w (pixel width)", optarg);
                         break;
+                case 'x':
+                        params->zoom_xoffs = strtold(optarg, &endptr);
+                        if (endptr == optarg)
+                                bad_arg("-x --x-offs", optarg);
+                        break;
+                case 'y':
+                        params->zoom_yoffs = strtold(optarg, &endptr);
+                        if (endptr == optarg)
+                                bad_arg("-y --y-offs", optarg);
+                        break;
+                case 'z':
+                        params->zoom_pct = strtold(optarg, &endptr);
+                        if (endptr == optarg || params->zoom_pct <= 0.0)
+                                bad_arg("-z --zoom-pct", optarg);
+                        break;
                 case '?':
                 default:
                         fprintf(stderr, "Unknown option -%c\n", opt);
@@ -593,9 +807,32 @@ parse_args(int argc, char **argv, struct params_t *params)
                 exit(EXIT_FAILURE);
         }
 
+        if (params->depth != 8 && pxbuf_format(outfile) != PXBUF_PNG) {
+                fprintf(stderr, "--depth=%d needs a .png output file\n",
+                        params->depth);
+                exit(EXIT_FAILURE);
+        }
+
         if (!EGFRACTAL_MULTITHREADED)
                 params->nthread = 1;
 
+        /*
+         * The first --resume file decides what we're drawing,
+         * and it's where we keep saving to unless told otherwise.
+         */
+        if (params->nresume > 0) {
+                dump_read_params(params->resume[0], params);
+                if (!params->dump)
+                        params->dump = params->resume[0];
+        }
+
+        if (params->sampler == SAMPLER_MH
+            && (params->use_line_x || params->use_line_y)) {
+                fprintf(stderr,
+                        "--sampler=mh cannot be used with --xline or --yline\n");
+                exit(EXIT_FAILURE);
+        }
+
         /* One quick sanity check */
         if (params->min >= params->n_red) {
                 fprintf(stderr, "min too high!\n");
@@ -634,9 +871,15 @@ main(int argc, char **argv)
         struct params_t params;
         FILE *fp;
         const char *outfile = parse_args(argc, argv, &params);
+        struct threadpool_t *pool;
         Pxbuf *pxbuf, *p2 = NULL;
         double overlay_ratio = 1.0;
 
+        pool = threadpool_create(params.nthread, params.affinity);
+        if (!pool)
+                oom();
+        pxbuf_set_pool(pool);
+
         if (params.overlay != NULL) {
                 char *endptr;
                 char *s = strchr(params.overlay, ',');
@@ -676,7 +919,7 @@ main(int argc, char **argv)
         if (!pxbuf)
                 oom();
 
-        bbrot2(pxbuf, &params);
+        bbrot2(pxbuf, &params, pool);
 
         fp = fopen(outfile, "wb");
         if (!fp) {
@@ -691,9 +934,15 @@ main(int argc, char **argv)
         pxbuf_rotate(pxbuf, false);
         if (p2)
                 pxbuf_overlay(pxbuf, p2, overlay_ratio);
-        pxbuf_print_to_bmp(pxbuf, fp, PXBUF_NORM_CLIP);
-        fclose(fp);
+        if (pxbuf_print(pxbuf, fp, pxbuf_format(outfile), PXBUF_NORM_CLIP,
+                        params.depth) < 0
+            || fclose(fp) != 0) {
+                fprintf(stderr, "Cannot write output file\n");
+                return 1;
+        }
 
+        pxbuf_set_pool(NULL);
+        threadpool_destroy(pool);
         pxbuf_destroy(pxbuf);
         return 0;
 }
@@ -0,0 +1,103 @@
+/*
+ * rng.c - Counter-based random numbers for bbrot2.
+ *
+ * bbrot2 used to give each thread its own erand48() sequence, seeded
+ * from the clock.  That meant no two runs were ever the same, the
+ * picture depended on how many threads there were, and two 48-bit
+ * LCGs side by side have a lattice structure you can sometimes see.
+ *
+ * Instead, point number i is made from Threefry-2x64 (see Salmon et
+ * al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC11) of the
+ * counter (i, stream), keyed with --seed.  It's a hash, not a
+ * sequence, so any thread can make any point's numbers without knowing
+ * anything about the points before it.  Whoever does point i, it's
+ * the same point.
+ */
+#include "bbrot2.h"
+#include <stdint.h>
+
+/* Threefry's key-schedule constant, from Skein */
+#define SKEIN_KS_PARITY 0x1BD11BDAA9FC1A22ull
+
+static inline __attribute__((always_inline)) uint64_t
+rotl64(uint64_t x, unsigned int n)
+{
+        return (x << n) | (x >> (64 - n));
+}
+
+/* One round of Threefry-2x64, rotating by @n */
+#define TF_ROUND(n) do {                \
+        x0 += x1;                       \
+        x1 = rotl64(x1, n);             \
+        x1 ^= x0;                       \
+} while (0)
+
+/* Four rounds, then the @s'th key injection */
+#define TF_ROUNDS4(a, b, c, d, s) do {  \
+        TF_ROUND(a);                    \
+        TF_ROUND(b);                    \
+        TF_ROUND(c);                    \
+        TF_ROUND(d);                    \
+        x0 += ks[(s) % 3];              \
+        x1 += ks[((s) + 1) % 3] + (s);  \
+} while (0)
+
+/*
+ * Threefry-2x64 with 20 rounds, @x is the counter going in and the
+ * random bits coming out.  The rounds are spelled out, rather than
+ * looped over, so that rng_points() can be vectorized.
+ */
+static inline __attribute__((always_inline)) void
+threefry2x64(uint64_t x[2], uint64_t k0, uint64_t k1)
+{
+        uint64_t ks[3] = { k0, k1, SKEIN_KS_PARITY ^ k0 ^ k1 };
+        uint64_t x0 = x[0] + ks[0];
+        uint64_t x1 = x[1] + ks[1];
+
+        TF_ROUNDS4(16, 42, 12, 31, 1);
+        TF_ROUNDS4(16, 32, 24, 21, 2);
+        TF_ROUNDS4(16, 42, 12, 31, 3);
+        TF_ROUNDS4(16, 32, 24, 21, 4);
+        TF_ROUNDS4(16, 42, 12, 31, 5);
+        x[0] = x0;
+        x[1] = x1;
+}
+
+/**
+ * rng_get - Get 128 random bits
+ * @seed: The --seed
+ * @i: Point number
+ * @stream: Which of point @i's numbers we want, an RNG_* value
+ * @out: Where to put them
+ */
+void
+rng_get(uint64_t seed, uint64_t i, unsigned int stream, uint64_t out[2])
+{
+        out[0] = i;
+        out[1] = stream;
+        threefry2x64(out, seed, 0);
+}
+
+/**
+ * rng_points - Get the random numbers for a batch of points
+ * @seed: The --seed
+ * @first: Number of the first point
+ * @n: Number of points
+ * @u: Array of @n numbers in [0:1) to fill in, one for each point
+ * @v: Another array of @n numbers, independent of @u
+ *
+ * These are stream RNG_POINT's numbers.  The loop has no dependencies
+ * from one point to the next, so the compiler can do it a few points
+ * at a time in SIMD registers.
+ */
+void
+rng_points(uint64_t seed, uint64_t first, size_t n, double *u, double *v)
+{
+        size_t j;
+        for (j = 0; j < n; j++) {
+                uint64_t x[2] = { first + j, RNG_POINT };
+                threefry2x64(x, seed, 0);
+                u[j] = rng_to_unit(x[0]);
+                v[j] = rng_to_unit(x[1]);
+        }
+}
@@ -48,7 +48,7 @@ main(int argc, char **argv)
         Pxbuf *pb;
 
         if (argc < 2) {
-                fprintf(stderr, "Expected: FILENAME.bmp\n");
+                fprintf(stderr, "Expected: FILENAME.bmp or FILENAME.png\n");
                 return 1;
         }
 
@@ -72,7 +72,7 @@ main(int argc, char **argv)
                 return 1;
         }
 
-        pxbuf_print_to_bmp(pb, fp, PXBUF_NORM_CLIP);
+        pxbuf_print(pb, fp, pxbuf_format(argv[1]), PXBUF_NORM_CLIP, 8);
         fclose(fp);
         pxbuf_destroy(pb);
         return 0;
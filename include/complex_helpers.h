@@ -73,7 +73,7 @@ static inline complex_t complex_sq(complex_t v)
         /* XXX: Faster to have just a mfloat_t tmp var & return v? */
         complex_t ret;
         ret.re = v.re * v.re - v.im * v.im;
-        ret.im = 2.0L * v.im * v.re;
+        ret.im = 2.0 * v.im * v.re;
         return ret;
 }
 
@@ -85,6 +85,14 @@ static inline complex_t complex_add(complex_t a, complex_t b)
         return a;
 }
 
+/* Subtract complex number b from a */
+static inline complex_t complex_sub(complex_t a, complex_t b)
+{
+        a.re -= b.re;
+        a.im -= b.im;
+        return a;
+}
+
 /* Add a real number to a complex number */
 static inline complex_t complex_addr(complex_t c, mfloat_t re)
 {
@@ -44,6 +44,35 @@ extern void bmp_print(FILE *fp, const unsigned char *array,
 extern void convolve(unsigned int *dest, const unsigned int *f,
                      const unsigned int *g, size_t fsize, size_t gsize);
 
+/* escape.c */
+enum escape_mode_t {
+        ESCAPE_MANDELBROT,
+        ESCAPE_JULIA,
+};
+struct escape_stats_t {
+        unsigned long nperiodic;   /* pixels caught by periodicity check */
+        unsigned long niter;       /* total iterations */
+};
+extern void escape_v(complex_t *z, const complex_t *c, long *count,
+                     size_t npx, unsigned long n, mfloat_t bailoutsqu,
+                     mfloat_t period_eps, enum escape_mode_t mode,
+                     struct escape_stats_t *stats);
+extern const char *escape_isa_name(void);
+
+/*
+ * Periodicity checks (Brent's method) compare z with a saved z from
+ * an earlier iteration, and give up on the point as inside if they're
+ * closer than this.  Tied to the distance between two pixels, since
+ * anything finer than that can't be seen anyway, but a good deal less
+ * than that, since slow-escaping points near the edge of the set
+ * spend a long time nearly repeating themselves before they leave.
+ */
+static inline mfloat_t
+period_eps(mfloat_t pixel_size)
+{
+        return pixel_size / 1024.0;
+}
+
 /* formulas.c */
 struct formula_t {
         complex_t (*fn)(complex_t, complex_t);
@@ -52,5 +81,70 @@ struct formula_t {
 };
 extern const struct formula_t *parse_formula(const char *name);
 
+/* tileq.c */
+/*
+ * struct tileq_t - Shared queue of tiles for the worker threads
+ * @next: Index of the next tile nobody has claimed yet.  Only ever
+ *        touched with atomic operations.
+ * @ntile: Total number of tiles in the image
+ * @ncol: Number of tiles per row of the image
+ * @rowstart: First row to hand out, zero unless from tileq_init_band()
+ * @height: One past the last row to hand out
+ *
+ * The image is chopped up into TILE_SIZE x TILE_SIZE squares (smaller
+ * at the right and bottom edges), and each thread grabs the next one
+ * whenever it finishes its last.  Since we don't know in advance which
+ * parts of the image are the slow ones, this keeps every thread busy
+ * until the whole image is done.
+ */
+enum { TILE_SIZE = 64 };
+struct tileq_t {
+        unsigned int next;
+        unsigned int ntile;
+        unsigned int ncol;
+        int rowstart;
+        int height;
+        int width;
+};
+
+struct tile_t {
+        int rowstart;
+        int rowend;
+        int colstart;
+        int colend;
+};
+extern void tileq_init(struct tileq_t *q, int width, int height);
+extern void tileq_init_band(struct tileq_t *q, int width,
+                            int rowstart, int rowend);
+extern bool tileq_next(struct tileq_t *q, struct tile_t *tile);
+
+/* progress.c */
+struct progress_reporter_t;
+struct progress_t {
+        const char *what;
+        unsigned long total;
+        unsigned long done;             /* atomic */
+        unsigned long niter;            /* atomic */
+        unsigned long long start;       /* all times in ns */
+        unsigned long long last;        /* atomic */
+        bool printing;                  /* atomic */
+        struct progress_reporter_t *reporter;
+};
+extern void progress_init(struct progress_t *p, const char *what,
+                          unsigned long total);
+extern void progress_add(struct progress_t *p, unsigned long n,
+                         unsigned long niter);
+extern void progress_done(struct progress_t *p);
+
+/* threadpool.c */
+struct threadpool_t;
+extern struct threadpool_t *threadpool_create(int nthread, bool affinity);
+extern int threadpool_submit(struct threadpool_t *pool,
+                             void (*fn)(void *), void *arg);
+extern void threadpool_wait(struct threadpool_t *pool);
+extern void threadpool_destroy(struct threadpool_t *pool);
+extern int threadpool_size(const struct threadpool_t *pool);
+extern int threadpool_ncpu(void);
+
 #endif /* FRACTAL_COMMON_H */
 
@@ -62,6 +62,49 @@ int pxbuf_normalize(Pxbuf *pxbuf, enum pxbuf_norm_t method,
 extern int pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp,
                 enum pxbuf_norm_t method);
 extern Pxbuf *pxbuf_read_from_bmp(FILE *fp);
+extern int pxbuf_bmp_write_header(FILE *fp, int width, int height);
+extern int pxbuf_bmp_write_rows(Pxbuf *pxbuf, FILE *fp,
+                enum pxbuf_norm_t method);
+
+/*
+ * struct pxbuf_xform_t - A recording of normalization, to do again
+ *
+ * For pictures too big to keep in one pxbuf: normalize a small preview
+ * of it with pxbuf_xform_normalize() and pxbuf_xform_negate(), then do
+ * the same to each band of the full picture with pxbuf_xform_apply().
+ */
+struct pxbuf_xform_t;
+extern struct pxbuf_xform_t *pxbuf_xform_create(void);
+extern void pxbuf_xform_destroy(struct pxbuf_xform_t *xf);
+extern int pxbuf_xform_normalize(struct pxbuf_xform_t *xf, Pxbuf *pxbuf,
+                enum pxbuf_norm_t method, float deviation, bool linked);
+extern void pxbuf_xform_negate(struct pxbuf_xform_t *xf, Pxbuf *pxbuf);
+extern void pxbuf_xform_apply(const struct pxbuf_xform_t *xf,
+                Pxbuf *pxbuf);
+
+/* png.c */
+struct pxbuf_png_t;
+extern int pxbuf_print_to_png(Pxbuf *pxbuf, FILE *fp,
+                enum pxbuf_norm_t method, int depth);
+extern struct pxbuf_png_t *pxbuf_png_start(FILE *fp, int width,
+                int height, int depth);
+extern int pxbuf_png_write_rows(struct pxbuf_png_t *png, Pxbuf *pxbuf,
+                enum pxbuf_norm_t method);
+extern int pxbuf_png_finish(struct pxbuf_png_t *png);
+
+/**
+ * enum pxbuf_format_t - Kinds of image file we can write
+ * @PXBUF_BMP: 24-bit BMP
+ * @PXBUF_PNG: PNG, 8 or 16 bits per channel
+ */
+enum pxbuf_format_t {
+        PXBUF_BMP,
+        PXBUF_PNG,
+};
+
+extern enum pxbuf_format_t pxbuf_format(const char *path);
+extern int pxbuf_print(Pxbuf *pxbuf, FILE *fp, enum pxbuf_format_t format,
+                enum pxbuf_norm_t method, int depth);
 
 extern Pxbuf *pxbuf_create(int width, int height);
 extern void pxbuf_destroy(Pxbuf *pxbuf);
@@ -69,6 +112,10 @@ extern int pxbuf_rotate(Pxbuf *pxbuf, bool cw);
 extern void pxbuf_negate(Pxbuf *pxbuf);
 extern void pxbuf_overlay(Pxbuf *dst, Pxbuf *src, double ratio);
 
+struct threadpool_t;
+extern void pxbuf_set_pool(struct threadpool_t *pool);
+extern struct threadpool_t *pxbuf_get_pool(void);
+
 extern void pxbuf_get_dimensions(Pxbuf *pxbuf, int *width, int *height);
 
 #if DBG_PXBUF
@@ -31,15 +31,22 @@
 #ifndef JULIA1_COMMON_H
 #define JULIA1_COMMON_H
 
+#include "config.h"
 #include "fractal_common.h"
 
+#ifndef EGFRACTAL_MULTITHREADED
+# define EGFRACTAL_MULTITHREADED 0
+#endif
+
 /* main.c */
 extern struct gbl_t {
         unsigned long n_iteration;
         int dither;
+        int nthread; /* 0 for one per CPU */
         int height;
         int width;
         int pallette;
+        int depth; /* bits per channel of a PNG */
         mfloat_t zoom_pct;
         mfloat_t zoom_xoffs;
         mfloat_t zoom_yoffs;
@@ -50,6 +57,7 @@ extern struct gbl_t {
         mfloat_t distance_root;
         mfloat_t eq_option;
         mfloat_t log_d;
+        mfloat_t period_eps;
         complex_t (*formula)(complex_t, complex_t);
         complex_t (*dformula)(complex_t, complex_t);
         bool distance_est;
@@ -58,6 +66,8 @@ extern struct gbl_t {
         bool color_distance;
         bool verbose;
         bool linked;
+        bool simd;
+        bool affinity;
 } gbl;
 
 /* palette.c */
@@ -33,6 +33,7 @@
 #include "pxbuf.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <assert.h>
 #include <math.h>
@@ -44,6 +45,7 @@ struct gbl_t gbl = {
         .height = 600,
         .width = 600,
         .pallette = 2,
+        .depth = 8,
         .zoom_pct = 1.0,
         .zoom_xoffs = 0.0,
         .zoom_yoffs = 0.0,
@@ -54,6 +56,7 @@ struct gbl_t gbl = {
         .distance_root = 0.25,
         .eq_option = 0.5L,
         .log_d = 0.,
+        .period_eps = 0.,
         .formula = NULL,
         .dformula = NULL,
         .distance_est = false,
@@ -62,6 +65,9 @@ struct gbl_t gbl = {
         .color_distance = false,
         .verbose = false,
         .linked = false,
+        .simd = true,
+        .nthread = 0,
+        .affinity = false,
 };
 
 /* Error helpers */
@@ -88,8 +94,9 @@ xy_to_complex(int row, int col)
 
 #define INSIDE (-1.0L)
 
+/* Iteration count is added to @stats */
 static mfloat_t
-iterate_distance(complex_t z)
+iterate_distance(complex_t z, struct escape_stats_t *stats)
 {
         unsigned long i, n = gbl.n_iteration;
         mfloat_t zmod;
@@ -116,6 +123,7 @@ iterate_distance(complex_t z)
                                 break;
                 }
         }
+        stats->niter += i;
         if (dz.re == 0.0 && dz.im == 0.0)
                 return -1L;
         assert(z.re != 0.0 || z.im != 0.0);
@@ -124,12 +132,39 @@ iterate_distance(complex_t z)
         return zmod * logl(zmod) / complex_modulus(dz);
 }
 
+static mfloat_t smooth_normal(unsigned long i, complex_t z,
+                              unsigned long px);
+
+/*
+ * Brent's periodicity check.  @zs is z as of iteration number @save.
+ * Return true if @z has come back around to it.
+ */
+static inline __attribute__((always_inline)) bool
+periodic(complex_t z, complex_t *zs, unsigned long i,
+         unsigned long *save, mfloat_t eps2)
+{
+        if (complex_modulus2(complex_sub(z, *zs)) < eps2)
+                return true;
+        if (i == *save) {
+                *zs = z;
+                *save *= 2;
+        }
+        return false;
+}
+
+/*
+ * Iteration count is added to @stats, and so is one more periodic
+ * pixel, if the periodicity check caught it.  @px is the pixel's
+ * number, for smooth_normal().
+ */
 static mfloat_t
-iterate_normal(complex_t z)
+iterate_normal(complex_t z, struct escape_stats_t *stats, unsigned long px)
 {
-        mfloat_t ret;
         unsigned long i, n = gbl.n_iteration;
+        unsigned long save = 1;
         complex_t c = { .re = gbl.cx, .im = gbl.cy };
+        complex_t zs = z;
+        mfloat_t eps2 = gbl.period_eps * gbl.period_eps;
 
         if (gbl.formula) {
                 for (i = 0; i < n; i++) {
@@ -138,6 +173,8 @@ iterate_normal(complex_t z)
                         if (complex_modulus2(z) >= gbl.bailoutsq)
                                 break;
                         z = gbl.formula(z, c);
+                        if (periodic(z, &zs, i, &save, eps2))
+                                goto periodic;
                 }
         } else {
                 /* "z = z^2 + c */
@@ -145,11 +182,42 @@ iterate_normal(complex_t z)
                         if (complex_modulus2(z) >= gbl.bailoutsq)
                                 break;
                         z = complex_add(complex_sq(z), c);
+                        if (periodic(z, &zs, i, &save, eps2))
+                                goto periodic;
                 }
         }
+        stats->niter += i;
         if (i == n)
                 return INSIDE;
 
+        return smooth_normal(i, z, px);
+
+periodic:
+        stats->nperiodic++;
+        stats->niter += i;
+        return INSIDE;
+}
+
+/* splitmix64's finalizer, good enough for dithering */
+static inline uint64_t
+dither_hash(uint64_t x)
+{
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+}
+
+/*
+ * Turn escape count @i into the value we save for pixel number @px
+ * (row * width + col).  The dither comes from a hash of @px, not from
+ * rand(), so it doesn't matter which thread gets to the pixel first.
+ */
+static mfloat_t
+smooth_normal(unsigned long i, complex_t z, unsigned long px)
+{
+        mfloat_t ret;
+
         /* TODO: Dither here */
         ret = (mfloat_t)i;
         if (gbl.dither > 0) {
@@ -168,11 +236,7 @@ iterate_normal(complex_t z)
 
                 if (!!(gbl.dither & 02)) {
                         /* Smooth by dithering */
-                        int v = rand();
-                        if (v < 0)
-                                v = (~0ul << 8) | (v & 0xff);
-                        else
-                                v &= 0xff;
+                        int v = dither_hash(px) & 0xff;
                         mfloat_t diff = (mfloat_t)v / 128.0L;
                         ret += diff;
                 }
@@ -185,48 +249,173 @@ iterate_normal(complex_t z)
         return ret;
 }
 
+/**
+ * struct julia_thread_t - Per-thread state for julia_thread()
+ * @tileq: Queue of tiles shared by all the threads
+ * @buf: The whole image, shared by all the threads.  They never touch
+ *       the same tile, so no need to lock it.
+ * @max: Highest pixel value this thread found
+ * @stats: This thread's iteration count, etc.
+ * @progress: Progress report for --verbose, or NULL
+ * @simd: True to hand the pixels to escape_v(), false to iterate them
+ *        one at a time
+ * @c, @z, @count: Scratch space for escape_v(), a tile's worth
+ */
+struct julia_thread_t {
+        struct tileq_t *tileq;
+        mfloat_t *buf;
+        mfloat_t max;
+        struct escape_stats_t stats;
+        struct progress_t *progress;
+        bool simd;
+        complex_t c[TILE_SIZE * TILE_SIZE];
+        complex_t z[TILE_SIZE * TILE_SIZE];
+        long count[TILE_SIZE * TILE_SIZE];
+};
+
 static mfloat_t
-julia_px(int row, int col)
+julia_px(int row, int col, struct julia_thread_t *jt)
 {
         complex_t z = xy_to_complex(row, col);
         if (gbl.distance_est)
-                return iterate_distance(z);
+                return iterate_distance(z, &jt->stats);
         else
-                return iterate_normal(z);
+                return iterate_normal(z, &jt->stats,
+                                      (unsigned long)row * gbl.width + col);
 }
 
+/*
+ * Like calling julia_px() for every pixel of @tile, except that it hands
+ * the whole tile to escape_v() to iterate several pixels at once.  Only
+ * for plain z^2+c without the distance estimate.
+ */
 static void
-julia(Pxbuf *pxbuf)
+julia_tile_v(struct julia_thread_t *jt, const struct tile_t *tile)
 {
+        complex_t c = { .re = gbl.cx, .im = gbl.cy };
+        size_t i, npx = 0;
         int row, col;
-        unsigned long total;
+
+        for (row = tile->rowstart; row < tile->rowend; row++) {
+                for (col = tile->colstart; col < tile->colend; col++) {
+                        jt->z[npx] = xy_to_complex(row, col);
+                        jt->c[npx] = c;
+                        npx++;
+                }
+        }
+
+        escape_v(jt->z, jt->c, jt->count, npx, gbl.n_iteration,
+                 gbl.bailoutsq, gbl.period_eps, ESCAPE_JULIA, &jt->stats);
+
+        i = 0;
+        for (row = tile->rowstart; row < tile->rowend; row++) {
+                mfloat_t *dst = &jt->buf[row * gbl.width];
+                for (col = tile->colstart; col < tile->colend; col++) {
+                        if (jt->count[i] < 0)
+                                dst[col] = INSIDE;
+                        else
+                                dst[col] = smooth_normal(jt->count[i],
+                                        jt->z[i],
+                                        (unsigned long)row * gbl.width + col);
+                        i++;
+                }
+        }
+}
+
+/*
+ * Thread pool task: calculate tiles until there aren't any left
+ */
+static void
+julia_thread(void *arg)
+{
+        struct julia_thread_t *jt = arg;
+        struct tile_t tile;
+
+        while (tileq_next(jt->tileq, &tile)) {
+                unsigned long niter = jt->stats.niter;
+                int row, col;
+
+                if (jt->simd)
+                        julia_tile_v(jt, &tile);
+                for (row = tile.rowstart; row < tile.rowend; row++) {
+                        mfloat_t *dst = &jt->buf[row * gbl.width];
+                        for (col = tile.colstart; col < tile.colend; col++) {
+                                if (!jt->simd)
+                                        dst[col] = julia_px(row, col, jt);
+                                if (dst[col] > jt->max)
+                                        jt->max = dst[col];
+                        }
+                }
+                if (jt->progress) {
+                        progress_add(jt->progress,
+                                     (tile.rowend - tile.rowstart)
+                                     * (tile.colend - tile.colstart),
+                                     jt->stats.niter - niter);
+                }
+        }
+}
+
+static void
+julia(Pxbuf *pxbuf, struct threadpool_t *pool)
+{
+        int row, col, i, nthread;
+        unsigned long nperiodic;
         mfloat_t *ptbuf, *tbuf, max;
+        struct julia_thread_t *jt;
+        struct tileq_t tileq;
+        struct progress_t progress;
+        bool simd = gbl.simd && !gbl.formula && !gbl.distance_est;
+
         tbuf = malloc(gbl.width * gbl.height * sizeof(*tbuf));
         if (!tbuf)
                 oom();
-        total = 0;
+        gbl.period_eps = period_eps(fmin(4.0L * gbl.zoom_pct / gbl.width,
+                                         4.0L * gbl.zoom_pct / gbl.height));
+
+        nthread = threadpool_size(pool);
+        jt = malloc(sizeof(*jt) * nthread);
+        if (!jt)
+                oom();
 
         if (gbl.verbose) {
-                printf("Row %9d col %9d", 0, 0);
-                fflush(stdout);
+                printf("Using %d threads\n", nthread);
+                if (simd)
+                        printf("Using %s escape-time kernel\n",
+                               escape_isa_name());
         }
-        ptbuf = tbuf;
+
+        tileq_init(&tileq, gbl.width, gbl.height);
+        if (gbl.verbose) {
+                progress_init(&progress, "px",
+                              (unsigned long)gbl.width * gbl.height);
+        }
+        for (i = 0; i < nthread; i++) {
+                jt[i].tileq     = &tileq;
+                jt[i].buf       = tbuf;
+                jt[i].max       = 0.0;
+                jt[i].stats.nperiodic = 0;
+                jt[i].stats.niter = 0;
+                jt[i].progress  = gbl.verbose ? &progress : NULL;
+                jt[i].simd      = simd;
+                if (threadpool_submit(pool, julia_thread, &jt[i]) < 0)
+                        oom();
+        }
+        threadpool_wait(pool);
+        if (gbl.verbose)
+                progress_done(&progress);
+
         max = 0.0;
-        for (row = 0; row < gbl.height; row++) {
-                for (col = 0; col < gbl.width; col++) {
-                        mfloat_t i = julia_px(row, col);
-                        if (gbl.verbose) {
-                                printf("\e[23D%9d col %9d", row, col);
-                                fflush(stdout);
-                        }
-                        if (i > max)
-                                max = i;
-                        total += (int)i;
-                        *ptbuf++ = i;
-                }
+        nperiodic = 0;
+        for (i = 0; i < nthread; i++) {
+                if (max < jt[i].max)
+                        max = jt[i].max;
+                nperiodic += jt[i].stats.nperiodic;
         }
+        free(jt);
+
         if (gbl.verbose)
-                putchar('\n');
+                printf("Periodicity check caught %lu pixels\n", nperiodic);
+
         ptbuf = tbuf;
         for (row = 0; row < gbl.height; row++) {
                 for (col = 0; col < gbl.width; col++) {
@@ -248,6 +437,7 @@ main(int argc, char **argv)
 {
         FILE *fp;
         const char *outfile;
+        struct threadpool_t *pool;
         Pxbuf *pxbuf;
 
         /* Initialize this "constant" */
@@ -261,7 +451,11 @@ main(int argc, char **argv)
                 return 1;
         }
 
-        julia(pxbuf);
+        pool = threadpool_create(gbl.nthread, gbl.affinity);
+        if (!pool)
+                oom();
+        pxbuf_set_pool(pool);
+        julia(pxbuf, pool);
 
         fp = fopen(outfile, "wb");
         if (!fp) {
@@ -277,8 +471,14 @@ main(int argc, char **argv)
         }
         if (gbl.negate)
                 pxbuf_negate(pxbuf);
-        pxbuf_print_to_bmp(pxbuf, fp, PXBUF_NORM_CLIP);
-        fclose(fp);
+        if (pxbuf_print(pxbuf, fp, pxbuf_format(outfile), PXBUF_NORM_CLIP,
+                        gbl.depth) < 0
+            || fclose(fp) != 0) {
+                fprintf(stderr, "Cannot write output file\n");
+                return 1;
+        }
+        pxbuf_set_pool(NULL);
+        threadpool_destroy(pool);
         pxbuf_destroy(pxbuf);
         return 0;
 }
@@ -1,4 +1,5 @@
 #include "julia1_common.h"
+#include "pxbuf.h"
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
@@ -22,6 +23,10 @@ parse_args(int argc, char **argv)
                 { "equalize",       optional_argument, NULL, 3 },
                 { "color-distance", no_argument,       NULL, 4 },
                 { "formula",        required_argument, NULL, 5 },
+                { "no-simd",        no_argument,       NULL, 6 },
+                { "nthread",        required_argument, NULL, 7 },
+                { "affinity",       no_argument,       NULL, 8 },
+                { "depth",          required_argument, NULL, 9 },
                 { "linked",         no_argument,       NULL, 'l' },
                 { "verbose",        no_argument,       NULL, 'v' },
                 { NULL,             0,                 NULL, 0 },
@@ -61,6 +66,29 @@ parse_args(int argc, char **argv)
                         gbl.log_d = f->log_d;
                         break;
                     }
+                case 6:
+                        gbl.simd = false;
+                        break;
+                case 7:
+                        gbl.nthread = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg)
+                                bad_arg("--nthread", optarg);
+                        /* warn user they're being stupid */
+                        if (gbl.nthread > 20) {
+                                fprintf(stderr, "%d threads! You cray!\n",
+                                        gbl.nthread);
+                        }
+                        break;
+                case 8:
+                        gbl.affinity = true;
+                        break;
+                case 9:
+                        gbl.depth = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg || *endptr != '\0'
+                            || (gbl.depth != 8 && gbl.depth != 16)) {
+                                bad_arg("--depth", optarg);
+                        }
+                        break;
                 case 'D':
                         gbl.distance_est = true;
                         if (optarg) {
@@ -140,6 +168,15 @@ parse_args(int argc, char **argv)
                         exit(EXIT_FAILURE);
                 }
         }
+
+        if (gbl.depth != 8 && pxbuf_format(outfile) != PXBUF_PNG) {
+                fprintf(stderr, "--depth=%d needs a .png output file\n",
+                        gbl.depth);
+                exit(EXIT_FAILURE);
+        }
+
+        if (!EGFRACTAL_MULTITHREADED)
+                gbl.nthread = 1;
         return outfile;
 }
 
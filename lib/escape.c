@@ -0,0 +1,126 @@
+/*
+ * escape.c - Lane-parallel escape-time iteration for plain z^2+c.
+ *
+ * The scalar iterators in mbrot2 and julia1 run one pixel at a time.
+ * This runs several pixels at once in SIMD lanes.  Whenever a lane's
+ * pixel escapes (or turns out to be inside), its result is saved and
+ * the lane is refilled with the next pixel, so that one slow pixel
+ * does not hold up the pixels in the other lanes.
+ *
+ * There are a few builds of the same kernel, one per instruction set.
+ * The best one the CPU supports is picked the first time we're called.
+ */
+#include "fractal_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && !defined(__clang__) \
+    && (defined(__x86_64__) || defined(__i386__))
+# define ESCAPE_X86_DISPATCH 1
+#else
+# define ESCAPE_X86_DISPATCH 0
+#endif
+
+/* Generic build, whatever the compiler's baseline is (SSE2 on x86-64) */
+#define KERNEL escape_v_generic
+#define NLANE 4
+#include "escape_kernel.h"
+
+#if ESCAPE_X86_DISPATCH
+# pragma GCC push_options
+# pragma GCC target("avx2")
+# define KERNEL escape_v_avx2
+# define NLANE 4
+# include "escape_kernel.h"
+# pragma GCC pop_options
+
+# pragma GCC push_options
+# pragma GCC target("avx512f")
+# define KERNEL escape_v_avx512
+# define NLANE 8
+# include "escape_kernel.h"
+# pragma GCC pop_options
+#endif /* ESCAPE_X86_DISPATCH */
+
+typedef void (*escape_fn_t)(complex_t *, const complex_t *, long *,
+                            size_t, unsigned long, mfloat_t, mfloat_t,
+                            enum escape_mode_t, struct escape_stats_t *);
+
+struct escape_isa_t {
+        const char *name;
+        escape_fn_t fn;
+};
+
+static const struct escape_isa_t *
+escape_isa(void)
+{
+        static const struct escape_isa_t GENERIC = {
+                "generic", escape_v_generic
+        };
+#if ESCAPE_X86_DISPATCH
+        static const struct escape_isa_t AVX2 = {
+                "avx2", escape_v_avx2
+        };
+        static const struct escape_isa_t AVX512 = {
+                "avx512f", escape_v_avx512
+        };
+#endif
+        static const struct escape_isa_t *isa = NULL;
+
+        /*
+         * Racy if two threads get here at once, but they'd both
+         * come up with the same answer, so who cares.
+         */
+        if (isa != NULL)
+                return isa;
+
+        isa = &GENERIC;
+#if ESCAPE_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+                isa = &AVX512;
+        else if (__builtin_cpu_supports("avx2"))
+                isa = &AVX2;
+#endif
+        return isa;
+}
+
+/**
+ * escape_isa_name - Name of the instruction set escape_v() will use
+ */
+const char *
+escape_isa_name(void)
+{
+        return escape_isa()->name;
+}
+
+/**
+ * escape_v - Iterate z = z^2 + c for an array of pixels
+ * @z: Array of @npx starting points for ESCAPE_JULIA (ignored for
+ *     ESCAPE_MANDELBROT, where z always starts at zero).  On return,
+ *     this holds the last value of z before bailout, for smoothing.
+ * @c: Array of @npx values of c
+ * @count: Array of @npx results.  Each is the number of iterations
+ *      before the pixel escaped, or -1 if it's considered inside.
+ * @npx: Number of pixels
+ * @n: Maximum number of iterations
+ * @bailoutsqu: Square of the bailout radius
+ * @period_eps: Periodicity-check tolerance, see period_eps(); zero
+ *              turns the check off.
+ * @mode: ESCAPE_MANDELBROT to match mbrot2's iterate_normal(), or
+ *        ESCAPE_JULIA to match julia1's.  They differ slightly in
+ *        when they check for bailout.
+ * @stats: Running totals to add this call's numbers to
+ *
+ * The answers are exactly the same as the scalar iterators' (that is
+ * the whole point, otherwise why use it?), so long as nobody lets the
+ * compiler contract the math into fused multiply-adds.
+ */
+void
+escape_v(complex_t *z, const complex_t *c, long *count, size_t npx,
+         unsigned long n, mfloat_t bailoutsqu, mfloat_t period_eps,
+         enum escape_mode_t mode, struct escape_stats_t *stats)
+{
+        escape_isa()->fn(z, c, count, npx, n, bailoutsqu,
+                         period_eps, mode, stats);
+}
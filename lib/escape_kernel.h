@@ -0,0 +1,174 @@
+/*
+ * escape_kernel.h - Body of the lane-parallel z^2+c iterator.
+ *
+ * This is not a normal header.  escape.c includes it once for every
+ * instruction set it supports, after defining:
+ *
+ *   KERNEL     name of the function to define
+ *   NLANE      number of pixels iterated at once
+ *
+ * and after setting the target with "#pragma GCC target" if need be.
+ * The code itself is plain GCC vector extensions, so the compiler
+ * picks the registers (SSE2, AVX2, AVX-512...) for whatever target
+ * is in effect when it's included.
+ */
+#if !defined(KERNEL) || !defined(NLANE)
+# error "Define KERNEL and NLANE before including escape_kernel.h"
+#endif
+
+static void
+KERNEL(complex_t *z, const complex_t *c, long *count, size_t npx,
+       unsigned long n, mfloat_t bailoutsqu, mfloat_t period_eps,
+       enum escape_mode_t mode, struct escape_stats_t *stats)
+{
+        typedef mfloat_t vfloat_t
+                __attribute__((vector_size(NLANE * sizeof(mfloat_t))));
+        typedef long long vint_t
+                __attribute__((vector_size(NLANE * sizeof(long long))));
+
+        /* zr, zi, as of iteration number @save, for periodicity check */
+        vfloat_t sr, si;
+        vint_t save;
+        vfloat_t zr, zi, cr, ci, bail, two, eps2;
+        vint_t it, vn, live;
+        size_t idx[NLANE];
+        size_t next = 0;
+        unsigned long nperiodic = 0;
+        unsigned long niter = 0;
+        int nlive = 0;
+        int l;
+        bool julia = mode == ESCAPE_JULIA;
+
+        for (l = 0; l < NLANE; l++) {
+                bail[l] = bailoutsqu;
+                two[l]  = 2.0;
+                vn[l]   = (long long)n;
+                eps2[l] = period_eps * period_eps;
+        }
+
+        /* Fill the lanes with the first NLANE pixels */
+        for (l = 0; l < NLANE; l++) {
+                if (next < npx) {
+                        idx[l] = next;
+                        cr[l]  = c[next].re;
+                        ci[l]  = c[next].im;
+                        zr[l]  = julia ? z[next].re : 0.0;
+                        zi[l]  = julia ? z[next].im : 0.0;
+                        it[l]  = 0;
+                        live[l] = -1;
+                        next++;
+                        nlive++;
+                } else {
+                        /* Dead lane, just spins on zero */
+                        cr[l] = ci[l] = zr[l] = zi[l] = 0.0;
+                        it[l]   = 0;
+                        live[l] = 0;
+                }
+                sr[l]   = zr[l];
+                si[l]   = zi[l];
+                save[l] = 1;
+        }
+
+        while (nlive > 0) {
+                vfloat_t zr2 = zr * zr;
+                vfloat_t zi2 = zi * zi;
+                /*
+                 * Keep the same order of operations as complex_sq()
+                 * and complex_add(), or we won't get the same
+                 * answer as the scalar iterators.
+                 */
+                vfloat_t tr = zr2 - zi2 + cr;
+                vfloat_t ti = two * zi * zr + ci;
+                vfloat_t dr = tr - sr;
+                vfloat_t di = ti - si;
+                vint_t done, inside, escaped, periodic, saving;
+                int any;
+
+                inside = it == vn;
+                if (julia) {
+                        escaped = (zr2 + zi2) >= bail;
+                } else {
+                        /* "Too precise for our data types" check */
+                        inside |= (tr == zr) & (ti == zi);
+                        escaped = (tr * tr + ti * ti) > bail;
+                }
+                periodic = ((dr * dr + di * di) < eps2) & ~escaped & ~inside;
+                done = (inside | escaped | periodic) & live;
+
+                any = 0;
+                for (l = 0; l < NLANE; l++)
+                        any |= done[l] != 0;
+                if (!any) {
+                        /*
+                         * Brent's method: save z every time the
+                         * iteration count hits a power of two.
+                         */
+                        saving = it == save;
+                        sr = (vfloat_t)(((vint_t)tr & saving)
+                                        | ((vint_t)sr & ~saving));
+                        si = (vfloat_t)(((vint_t)ti & saving)
+                                        | ((vint_t)si & ~saving));
+                        save += save & saving;
+                        zr = tr;
+                        zi = ti;
+                        it += 1;
+                        continue;
+                }
+
+                /*
+                 * Slow path: at least one lane finished.  Save its
+                 * result and refill it with the next pixel, and
+                 * step the others along as usual.
+                 */
+                for (l = 0; l < NLANE; l++) {
+                        size_t i;
+                        if (!done[l]) {
+                                if (it[l] == save[l]) {
+                                        sr[l] = tr[l];
+                                        si[l] = ti[l];
+                                        save[l] *= 2;
+                                }
+                                zr[l] = tr[l];
+                                zi[l] = ti[l];
+                                it[l] += 1;
+                                continue;
+                        }
+
+                        /*
+                         * Either way z is left at its value before
+                         * this step, same as the scalar iterators.
+                         */
+                        i = idx[l];
+                        count[i] = (inside[l] || periodic[l])
+                                   ? -1 : (long)it[l];
+                        if (periodic[l])
+                                nperiodic++;
+                        niter += it[l];
+                        z[i].re = zr[l];
+                        z[i].im = zi[l];
+
+                        if (next < npx) {
+                                idx[l] = next;
+                                cr[l]  = c[next].re;
+                                ci[l]  = c[next].im;
+                                zr[l]  = julia ? z[next].re : 0.0;
+                                zi[l]  = julia ? z[next].im : 0.0;
+                                it[l]  = 0;
+                                next++;
+                        } else {
+                                cr[l] = ci[l] = zr[l] = zi[l] = 0.0;
+                                it[l]   = 0;
+                                live[l] = 0;
+                                nlive--;
+                        }
+                        sr[l]   = zr[l];
+                        si[l]   = zi[l];
+                        save[l] = 1;
+                }
+        }
+        stats->nperiodic += nperiodic;
+        stats->niter += niter;
+}
+
+#undef KERNEL
+#undef NLANE
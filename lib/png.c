@@ -0,0 +1,600 @@
+/*
+ * png.c - Write a pxbuf out as a PNG file.
+ *
+ * This saves the trip through a huge BMP and an image converter, and
+ * it can write 16 bits per channel, which BMP can't, so that smooth
+ * gradients in the floats of a pxbuf don't come out as bands.
+ *
+ * Like pxbuf_bmp_write_rows(), a picture can be written a band of rows
+ * at a time; see pxbuf_png_start().  Each band is cut up into strips
+ * that are filtered and compressed separately, in as many threads as
+ * there are strips, and written out in order, each as its own IDAT
+ * chunk.  Every strip but the last ends on a byte boundary with a
+ * deflate "sync flush", so they can be stuck together into one zlib
+ * stream; their Adler-32 checksums are stuck together with
+ * adler32_combine().  That's the trick pigz uses.
+ *
+ * Without zlib, the strips are written as uncompressed deflate
+ * "stored" blocks.  The files are big, but still proper PNGs.
+ */
+#include "config.h"
+#include "pxbuf.h"
+#include "fractal_common.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if EGFRACTAL_ZLIB
+# include <zlib.h>
+/* Second byte of the zlib header; its FLEVEL bits are only a hint */
+# define ZHDR_FLG 0x9c  /* default compression */
+#else
+# define ZHDR_FLG 0x01  /* fastest, which storing is */
+#endif
+
+enum {
+        /* Bytes of uncompressed image per strip, roughly */
+        PNG_STRIP = 1024 * 1024,
+        /* Room for the zlib header at the start of a strip... */
+        ZHDR_SIZE = 2,
+        /* ...and its checksum at the end */
+        ZTRL_SIZE = 4,
+        NFILTER = 5,
+};
+
+struct pxbuf_png_t {
+        FILE *fp;
+        int width;
+        int height;
+        int depth;              /* bits per channel */
+        int bpp;                /* bytes per pixel */
+        size_t rowlen;          /* bytes per row, not counting filter type */
+        int row;                /* rows written so far */
+        unsigned char *prev;    /* the last of them, unfiltered */
+        uint32_t adler;         /* of everything compressed so far */
+        struct threadpool_t *pool;
+        bool error;
+};
+
+/* One task for the thread pool */
+struct png_strip_t {
+        struct pxbuf_png_t *png;
+        Pxbuf *pxbuf;
+        int top;                /* first row, counted down from @pxbuf's top */
+        int nrow;
+        bool last;              /* of the whole picture */
+        unsigned char *out;     /* ZHDR_SIZE bytes, then the deflate data */
+        size_t outlen;          /* of the deflate data */
+        size_t inlen;           /* of the filtered rows that went into it */
+        uint32_t adler;         /* of those */
+        int err;
+};
+
+static unsigned char *
+pack_be32(unsigned char *p, uint32_t v)
+{
+        *p++ = v >> 24;
+        *p++ = v >> 16;
+        *p++ = v >> 8;
+        *p++ = v;
+        return p;
+}
+
+#if !EGFRACTAL_ZLIB
+/* Stand-ins for the bits of zlib we'd use */
+
+static uint32_t
+crc32(uint32_t crc, const unsigned char *buf, size_t len)
+{
+        static uint32_t table[256];
+        static bool have_table = false;
+        size_t i;
+
+        /* Racy, but every thread would come up with the same table */
+        if (!have_table) {
+                for (i = 0; i < 256; i++) {
+                        uint32_t c = i;
+                        int k;
+                        for (k = 0; k < 8; k++)
+                                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+                        table[i] = c;
+                }
+                have_table = true;
+        }
+        crc = ~crc;
+        for (i = 0; i < len; i++)
+                crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+        return ~crc;
+}
+
+enum { ADLER_BASE = 65521 };
+
+static uint32_t
+adler32(uint32_t adler, const unsigned char *buf, size_t len)
+{
+        uint32_t a = adler & 0xffff, b = adler >> 16;
+        while (len > 0) {
+                /* As many as we can add before we have to take the mod */
+                size_t n = len < 5552 ? len : 5552;
+                len -= n;
+                while (n-- > 0) {
+                        a += *buf++;
+                        b += a;
+                }
+                a %= ADLER_BASE;
+                b %= ADLER_BASE;
+        }
+        return a | (b << 16);
+}
+
+/* Checksum of A followed by B, from theirs and B's length @len2 */
+static uint32_t
+adler32_combine(uint32_t a1, uint32_t a2, size_t len2)
+{
+        uint64_t rem = len2 % ADLER_BASE;
+        uint64_t s1 = a1 & 0xffff;
+        uint64_t s2 = rem * s1 % ADLER_BASE;
+
+        s1 += (a2 & 0xffff) + ADLER_BASE - 1;
+        s2 += (a1 >> 16) + (a2 >> 16) + ADLER_BASE - rem;
+        return (s1 % ADLER_BASE) | ((s2 % ADLER_BASE) << 16);
+}
+#endif /* !EGFRACTAL_ZLIB */
+
+static int
+png_chunk(struct pxbuf_png_t *png, const char *type,
+          const unsigned char *data, size_t len)
+{
+        unsigned char hdr[8], crc[4];
+        uint32_t c;
+
+        pack_be32(hdr, len);
+        memcpy(&hdr[4], type, 4);
+        c = crc32(0, &hdr[4], 4);
+        /* zlib's crc32() would take a NULL @data to mean start over */
+        if (len > 0)
+                c = crc32(c, data, len);
+        pack_be32(crc, c);
+        if (fwrite(hdr, sizeof(hdr), 1, png->fp) != 1
+            || (len > 0 && fwrite(data, len, 1, png->fp) != 1)
+            || fwrite(crc, sizeof(crc), 1, png->fp) != 1) {
+                png->error = true;
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * Unfiltered bytes of @pxbuf's row @top rows down from its top.
+ * pxbuf rows go bottom to top, like BMP's, and PNG's go top to bottom.
+ * Channels go from BGR to RGB, and values round the same way as BMP's,
+ * so that an 8-bit PNG has the same colors as the BMP would.  For
+ * 16 bits, the scale is 257 times as big, so the brightest a pxbuf
+ * gets after normalizing (255 in BMP) is 65535.
+ */
+static void
+png_encode_row(struct pxbuf_png_t *png, Pxbuf *pxbuf, int top,
+               unsigned char *dst)
+{
+        int h, col;
+        const float *src;
+
+        pxbuf_get_dimensions(pxbuf, NULL, &h);
+        src = pxbuf_get_pixel(pxbuf, h - 1 - top, 0)->x;
+        for (col = 0; col < png->width; col++, src += 3) {
+                int i;
+                for (i = 2; i >= 0; i--) {
+                        if (png->depth == 16) {
+                                int v = (int)(src[i] * 65792.0 + 0.5);
+                                v = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+                                *dst++ = v >> 8;
+                                *dst++ = v;
+                        } else {
+                                int v = (int)(src[i] * 256.0 + 0.5);
+                                *dst++ = v < 0 ? 0 : (v > 255 ? 255 : v);
+                        }
+                }
+        }
+}
+
+static inline int
+paeth(int a, int b, int c)
+{
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+                return a;
+        return pb <= pc ? b : c;
+}
+
+/*
+ * Filter @cur, whose unfiltered row above is @up, into each of
+ * @filt[0] to @filt[4] (filter types None to Paeth), and return the
+ * one to use.  That's the one whose bytes, taken as signed, add up to
+ * the least, which is the usual guess at which one deflate will like
+ * best.
+ */
+static unsigned char *
+png_filter_row(struct pxbuf_png_t *png, const unsigned char *cur,
+               const unsigned char *up, unsigned char *filt[NFILTER])
+{
+        size_t i, len = png->rowlen;
+        int bpp = png->bpp;
+        unsigned long sum[NFILTER] = { 0 };
+        int f, best = 0;
+
+        for (f = 0; f < NFILTER; f++)
+                filt[f][0] = f;
+        for (i = 0; i < len; i++) {
+                int x = cur[i], b = up[i];
+                int a = i >= bpp ? cur[i - bpp] : 0;
+                int c = i >= bpp ? up[i - bpp] : 0;
+
+                filt[0][i + 1] = x;
+                filt[1][i + 1] = x - a;
+                filt[2][i + 1] = x - b;
+                filt[3][i + 1] = x - ((a + b) >> 1);
+                filt[4][i + 1] = x - paeth(a, b, c);
+                for (f = 0; f < NFILTER; f++)
+                        sum[f] += abs((signed char)filt[f][i + 1]);
+        }
+        for (f = 1; f < NFILTER; f++) {
+                if (sum[f] < sum[best])
+                        best = f;
+        }
+        return filt[best];
+}
+
+#if EGFRACTAL_ZLIB
+typedef z_stream png_deflate_t;
+
+/* Get ready for @nrow rows of @len bytes, return room needed for them */
+static size_t
+png_deflate_begin(png_deflate_t *zs, size_t len, int nrow)
+{
+        memset(zs, 0, sizeof(*zs));
+        /* Negative window bits for raw deflate, no zlib header */
+        if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                         Z_FILTERED) != Z_OK) {
+                return 0;
+        }
+        /* Plus a little for the sync flush at the end */
+        return deflateBound(zs, len * nrow) + 16;
+}
+
+static int
+png_deflate(png_deflate_t *zs, unsigned char **dst, size_t *room,
+            unsigned char *src, size_t len, bool flush, bool last)
+{
+        int ret;
+
+        zs->next_in = src;
+        zs->avail_in = len;
+        zs->next_out = *dst;
+        zs->avail_out = *room;
+        ret = deflate(zs, !flush ? Z_NO_FLUSH
+                          : (last ? Z_FINISH : Z_SYNC_FLUSH));
+        *dst = zs->next_out;
+        *room = zs->avail_out;
+        if (zs->avail_in != 0 || ret == Z_STREAM_ERROR)
+                return -1;
+        if (flush && (last ? ret != Z_STREAM_END : zs->avail_out == 0))
+                return -1;
+        return 0;
+}
+
+static void
+png_deflate_end(png_deflate_t *zs)
+{
+        deflateEnd(zs);
+}
+#else /* !EGFRACTAL_ZLIB */
+typedef int png_deflate_t;
+
+static size_t
+png_deflate_begin(png_deflate_t *zs, size_t len, int nrow)
+{
+        /* Each row in its own stored blocks, five bytes of header each */
+        return (len + 5 * (len / 65535 + 1)) * nrow;
+}
+
+static int
+png_deflate(png_deflate_t *zs, unsigned char **dst, size_t *room,
+            unsigned char *src, size_t len, bool flush, bool last)
+{
+        unsigned char *p = *dst;
+
+        do {
+                size_t n = len < 65535 ? len : 65535;
+                if (*room < n + 5)
+                        return -1;
+                /* BFINAL on the last block of the last strip */
+                *p++ = flush && last && n == len;
+                *p++ = n;
+                *p++ = n >> 8;
+                *p++ = ~n;
+                *p++ = ~n >> 8;
+                memcpy(p, src, n);
+                p += n;
+                src += n;
+                len -= n;
+                *room -= n + 5;
+        } while (len > 0);
+        *dst = p;
+        return 0;
+}
+
+static void
+png_deflate_end(png_deflate_t *zs)
+{
+}
+#endif /* !EGFRACTAL_ZLIB */
+
+/* Filter and compress one strip, see struct png_strip_t */
+static void
+png_strip(void *arg)
+{
+        struct png_strip_t *s = (struct png_strip_t *)arg;
+        struct pxbuf_png_t *png = s->png;
+        size_t rowlen = png->rowlen;
+        unsigned char *filt[NFILTER];
+        unsigned char *work, *cur, *up, *dst;
+        png_deflate_t zs;
+        size_t room;
+        int i;
+
+        s->err = -1;
+        s->inlen = (rowlen + 1) * s->nrow;
+        s->adler = 1;
+        room = png_deflate_begin(&zs, rowlen + 1, s->nrow);
+        if (!room)
+                return;
+        work = malloc(2 * rowlen + NFILTER * (rowlen + 1));
+        s->out = malloc(ZHDR_SIZE + room + ZTRL_SIZE);
+        if (!work || !s->out)
+                goto out;
+        cur = work;
+        up = &work[rowlen];
+        for (i = 0; i < NFILTER; i++)
+                filt[i] = &work[2 * rowlen + i * (rowlen + 1)];
+
+        /*
+         * Above the first strip of a band is the last row of the band
+         * before, or zeros at the top of the picture.
+         */
+        if (s->top == 0)
+                memcpy(up, png->prev, rowlen);
+        else
+                png_encode_row(png, s->pxbuf, s->top - 1, up);
+
+        dst = &s->out[ZHDR_SIZE];
+        for (i = 0; i < s->nrow; i++) {
+                unsigned char *f, *tmp;
+
+                png_encode_row(png, s->pxbuf, s->top + i, cur);
+                f = png_filter_row(png, cur, up, filt);
+                s->adler = adler32(s->adler, f, rowlen + 1);
+                if (png_deflate(&zs, &dst, &room, f, rowlen + 1,
+                                i == s->nrow - 1, s->last) < 0) {
+                        goto out;
+                }
+                tmp = up;
+                up = cur;
+                cur = tmp;
+        }
+        s->outlen = dst - &s->out[ZHDR_SIZE];
+        s->err = 0;
+
+out:
+        png_deflate_end(&zs);
+        free(work);
+}
+
+/* Write a finished strip out as an IDAT chunk */
+static int
+png_put_strip(struct pxbuf_png_t *png, struct png_strip_t *s)
+{
+        unsigned char *data = &s->out[ZHDR_SIZE];
+        size_t len = s->outlen;
+
+        if (png->row == 0 && s->top == 0) {
+                /* Deflate, 32k window */
+                data = s->out;
+                data[0] = 0x78;
+                data[1] = ZHDR_FLG;
+                len += ZHDR_SIZE;
+        }
+        png->adler = adler32_combine(png->adler, s->adler, s->inlen);
+        if (s->last) {
+                pack_be32(&data[len], png->adler);
+                len += ZTRL_SIZE;
+        }
+        return png_chunk(png, "IDAT", data, len);
+}
+
+/**
+ * pxbuf_png_start - Start writing a PNG file
+ * @fp: File to write to
+ * @width: Width of the whole picture
+ * @height: Height of the whole picture
+ * @depth: Bits per channel, 8 or 16
+ *
+ * The rows are compressed in the pool set with pxbuf_set_pool(), if
+ * any.  Send them with pxbuf_png_write_rows(), then call
+ * pxbuf_png_finish().
+ *
+ * Return the new handle, or NULL if out of memory, @depth is neither
+ * 8 nor 16, or the header could not be written.
+ */
+struct pxbuf_png_t *
+pxbuf_png_start(FILE *fp, int width, int height, int depth)
+{
+        static const unsigned char SIGNATURE[8] = {
+                0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n',
+        };
+        struct pxbuf_png_t *png;
+        unsigned char ihdr[13], phys[9], *p;
+
+        if (depth != 8 && depth != 16)
+                return NULL;
+        png = malloc(sizeof(*png));
+        if (!png)
+                return NULL;
+        memset(png, 0, sizeof(*png));
+        png->fp     = fp;
+        png->width  = width;
+        png->height = height;
+        png->depth  = depth;
+        png->bpp    = 3 * depth / 8;
+        png->rowlen = (size_t)width * png->bpp;
+        png->adler  = 1;
+        png->prev   = calloc(1, png->rowlen);
+        if (!png->prev) {
+                free(png);
+                return NULL;
+        }
+
+        png->pool = pxbuf_get_pool();
+
+        p = pack_be32(ihdr, width);
+        p = pack_be32(p, height);
+        *p++ = depth;
+        *p++ = 2;       /* RGB */
+        *p++ = 0;       /* deflate */
+        *p++ = 0;       /* adaptive filtering */
+        *p++ = 0;       /* not interlaced */
+
+        /* 300 dpi, same as pxbuf_bmp_write_header() */
+        p = pack_be32(phys, 11811);
+        p = pack_be32(p, 11811);
+        *p++ = 1;       /* pixels per meter */
+
+        if (fwrite(SIGNATURE, sizeof(SIGNATURE), 1, fp) != 1
+            || png_chunk(png, "IHDR", ihdr, sizeof(ihdr)) < 0
+            || png_chunk(png, "pHYs", phys, sizeof(phys)) < 0) {
+                pxbuf_png_finish(png);
+                return NULL;
+        }
+        return png;
+}
+
+/**
+ * pxbuf_png_write_rows - Write all of @pxbuf's rows to a PNG file
+ * @png: Handle from pxbuf_png_start()
+ * @pxbuf: Rows to write, which may be just a band of the picture, as
+ *         wide as it is
+ * @method: Normalization, as for pxbuf_bmp_write_rows()
+ *
+ * PNG goes from the top of the picture down, the other way from BMP,
+ * so if the picture is being sent a band at a time, the bands have to
+ * go from the top down: the band with the highest row numbers first.
+ *
+ * Return 0 if okay, -1 if out of memory or there was a write error.
+ */
+int
+pxbuf_png_write_rows(struct pxbuf_png_t *png, Pxbuf *pxbuf,
+                     enum pxbuf_norm_t method)
+{
+        struct png_strip_t *strip;
+        int w, h, top, nper, nbatch, i, j, n;
+        int ret = 0;
+
+        pxbuf_get_dimensions(pxbuf, &w, &h);
+        if (w != png->width || png->row + h > png->height)
+                return -1;
+
+        nper = PNG_STRIP / png->rowlen;
+        if (nper < 1)
+                nper = 1;
+        /* Only so many strips at once, they all have to be in memory */
+        nbatch = png->pool ? 2 * threadpool_size(png->pool) : 1;
+        strip = malloc(sizeof(*strip) * nbatch);
+        if (!strip)
+                return -1;
+
+        pxbuf_normalize(pxbuf, method, 3.0, PXBUF_ALLCHAN);
+        for (top = 0; top < h && ret == 0; top += n) {
+                for (n = 0, i = 0; i < nbatch && top + n < h; i++) {
+                        struct png_strip_t *s = &strip[i];
+
+                        memset(s, 0, sizeof(*s));
+                        s->png   = png;
+                        s->pxbuf = pxbuf;
+                        s->top   = top + n;
+                        s->nrow  = h - s->top < nper ? h - s->top : nper;
+                        s->last  = png->row + s->top + s->nrow
+                                   == png->height;
+                        n += s->nrow;
+                        if (!png->pool
+                            || threadpool_submit(png->pool,
+                                                 png_strip, s) < 0) {
+                                png_strip(s);
+                        }
+                }
+                if (png->pool)
+                        threadpool_wait(png->pool);
+
+                for (n = 0, j = 0; j < i; j++) {
+                        struct png_strip_t *s = &strip[j];
+                        n += s->nrow;
+                        if (ret == 0)
+                                ret = s->err;
+                        if (ret == 0)
+                                ret = png_put_strip(png, s);
+                        free(s->out);
+                }
+        }
+        free(strip);
+        if (ret < 0) {
+                png->error = true;
+                return ret;
+        }
+
+        png_encode_row(png, pxbuf, h - 1, png->prev);
+        png->row += h;
+        return 0;
+}
+
+/**
+ * pxbuf_png_finish - Finish off a PNG file and free @png
+ *
+ * Return 0 if every row was written without any trouble, -1 if not.
+ * Either way, it's up to the caller to close the file.
+ */
+int
+pxbuf_png_finish(struct pxbuf_png_t *png)
+{
+        int ret;
+
+        if (png->row == png->height)
+                png_chunk(png, "IEND", NULL, 0);
+        ret = png->row == png->height && !png->error ? 0 : -1;
+        free(png->prev);
+        free(png);
+        return ret;
+}
+
+/**
+ * pxbuf_print_to_png - Write @pxbuf to a PNG file
+ * @pxbuf: Picture to write
+ * @fp: File to write it to
+ * @method: Normalization, as for pxbuf_print_to_bmp()
+ * @depth: Bits per channel, 8 or 16
+ *
+ * Return 0 if okay, -1 if not.
+ */
+int
+pxbuf_print_to_png(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method,
+                   int depth)
+{
+        struct pxbuf_png_t *png;
+        int w, h, ret;
+
+        pxbuf_get_dimensions(pxbuf, &w, &h);
+        png = pxbuf_png_start(fp, w, h, depth);
+        if (!png)
+                return -1;
+        ret = pxbuf_png_write_rows(png, pxbuf, method);
+        if (pxbuf_png_finish(png) < 0)
+                ret = -1;
+        return ret;
+}
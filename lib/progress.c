@@ -0,0 +1,232 @@
+/*
+ * progress.c - Progress reports for -v, shared by all the programs.
+ *
+ * The worker threads call progress_add() whenever they finish a chunk
+ * of work (a tile, a batch of points...).  That's just a couple of
+ * atomic adds.  A reporter thread of its own wakes up every so often
+ * and prints a status line from the counts, so a slow terminal never
+ * holds up a worker.
+ *
+ * Without pthreads, or if the reporter can't be started, progress_add()
+ * prints the status line itself when it's due.
+ */
+#include "config.h"
+#include "fractal_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if EGFRACTAL_MULTITHREADED
+# include <pthread.h>
+#endif
+
+/* Nanoseconds between status lines */
+static const unsigned long long PROGRESS_INTERVAL = 500000000;
+
+/* Nanoseconds since whenever */
+static unsigned long long
+progress_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Print 1234567 as "1.23M", etc. */
+static void
+progress_si(char *buf, size_t size, double v)
+{
+        static const char SUFFIX[] = " kMGTPE";
+        int i = 0;
+        while (v >= 1000.0 && SUFFIX[i + 1] != '\0') {
+                v /= 1000.0;
+                i++;
+        }
+        if (i == 0)
+                snprintf(buf, size, "%.0f", v);
+        else
+                snprintf(buf, size, "%.2f%c", v, SUFFIX[i]);
+}
+
+static void
+progress_print(struct progress_t *p, unsigned long long now, bool final)
+{
+        unsigned long done = __atomic_load_n(&p->done, __ATOMIC_RELAXED);
+        unsigned long niter = __atomic_load_n(&p->niter, __ATOMIC_RELAXED);
+        double elapsed = (double)(now - p->start) * 1.0e-9;
+        double pct = p->total ? 100.0 * done / p->total : 100.0;
+        char rate[16], irate[16];
+
+        if (elapsed <= 0.0)
+                elapsed = 1.0e-9;
+        progress_si(rate, sizeof(rate), done / elapsed);
+        progress_si(irate, sizeof(irate), niter / elapsed);
+        printf("\r%5.1f%%  %s %s/s  %s iter/s  ",
+               pct, rate, p->what, irate);
+        if (final) {
+                printf("done in %.1fs\n", elapsed);
+        } else if (done > 0) {
+                double eta = elapsed * (p->total - done) / done;
+                printf("ETA %d:%02d   ", (int)eta / 60, (int)eta % 60);
+        }
+        fflush(stdout);
+}
+
+#if EGFRACTAL_MULTITHREADED
+
+struct progress_reporter_t {
+        struct progress_t *p;
+        pthread_t id;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;    /* time to stop */
+        bool stop;
+};
+
+static void *
+progress_reporter(void *arg)
+{
+        struct progress_reporter_t *r = arg;
+        struct timespec ts;
+
+        pthread_mutex_lock(&r->lock);
+        for (;;) {
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                ts.tv_nsec += PROGRESS_INTERVAL % 1000000000;
+                ts.tv_sec += PROGRESS_INTERVAL / 1000000000
+                             + ts.tv_nsec / 1000000000;
+                ts.tv_nsec %= 1000000000;
+                while (!r->stop
+                       && pthread_cond_timedwait(&r->wake, &r->lock,
+                                                 &ts) == 0) {
+                        ;
+                }
+                if (r->stop)
+                        break;
+                pthread_mutex_unlock(&r->lock);
+                progress_print(r->p, progress_now(), false);
+                pthread_mutex_lock(&r->lock);
+        }
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+}
+
+/* Start @p's reporter thread, or leave it NULL if we can't */
+static void
+progress_start(struct progress_t *p)
+{
+        struct progress_reporter_t *r = malloc(sizeof(*r));
+        pthread_condattr_t attr;
+
+        if (!r)
+                return;
+        r->p = p;
+        r->stop = false;
+        pthread_mutex_init(&r->lock, NULL);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&r->wake, &attr);
+        pthread_condattr_destroy(&attr);
+        if (pthread_create(&r->id, NULL, progress_reporter, r) != 0) {
+                pthread_cond_destroy(&r->wake);
+                pthread_mutex_destroy(&r->lock);
+                free(r);
+                return;
+        }
+        p->reporter = r;
+}
+
+/* Stop @p's reporter thread, if it has one */
+static void
+progress_stop(struct progress_t *p)
+{
+        struct progress_reporter_t *r = p->reporter;
+
+        if (!r)
+                return;
+        pthread_mutex_lock(&r->lock);
+        r->stop = true;
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->id, NULL);
+        pthread_cond_destroy(&r->wake);
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        p->reporter = NULL;
+}
+
+#else /* !EGFRACTAL_MULTITHREADED */
+
+static void
+progress_start(struct progress_t *p)
+{
+        return;
+}
+
+static void
+progress_stop(struct progress_t *p)
+{
+        return;
+}
+
+#endif /* !EGFRACTAL_MULTITHREADED */
+
+/**
+ * progress_init - Start the clock on a progress report
+ * @p: Progress report to initialize
+ * @what: What we're counting, like "px" or "points", for the status line
+ * @total: How many of them there are
+ */
+void
+progress_init(struct progress_t *p, const char *what, unsigned long total)
+{
+        memset(p, 0, sizeof(*p));
+        p->what  = what;
+        p->total = total;
+        p->start = p->last = progress_now();
+        progress_start(p);
+}
+
+/**
+ * progress_add - Report some finished work
+ * @p: Progress report
+ * @n: How many more things (same units as @total in progress_init())
+ *     are done
+ * @niter: How many iterations it took to do them
+ *
+ * Safe to call from any thread, as often as once per tile or so.
+ */
+void
+progress_add(struct progress_t *p, unsigned long n, unsigned long niter)
+{
+        unsigned long long now;
+
+        __atomic_add_fetch(&p->done, n, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p->niter, niter, __ATOMIC_RELAXED);
+        if (p->reporter)
+                return;
+
+        now = progress_now();
+        if (now < __atomic_load_n(&p->last, __ATOMIC_RELAXED)
+                  + PROGRESS_INTERVAL) {
+                return;
+        }
+        if (__atomic_exchange_n(&p->printing, true, __ATOMIC_ACQUIRE))
+                return;
+        if (now >= p->last + PROGRESS_INTERVAL) {
+                __atomic_store_n(&p->last, now, __ATOMIC_RELAXED);
+                progress_print(p, now, false);
+        }
+        __atomic_store_n(&p->printing, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * progress_done - Stop the reporter and print the final status line
+ *
+ * Call after all the threads have finished.  Every progress_init()
+ * needs one of these.
+ */
+void
+progress_done(struct progress_t *p)
+{
+        progress_stop(p);
+        progress_print(p, progress_now(), true);
+}
@@ -1,11 +1,14 @@
 #include "pxbuf.h"
+#include "fractal_common.h"
 #include <errno.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -52,7 +55,7 @@ pack16(unsigned char *p, unsigned long v)
 }
 
 static unsigned long
-unpack16(unsigned char *p)
+unpack16(const unsigned char *p)
 {
         unsigned long ret;
         ret = p[1];
@@ -61,7 +64,7 @@ unpack16(unsigned char *p)
 }
 
 static unsigned long
-unpack32(unsigned char *p)
+unpack32(const unsigned char *p)
 {
         unsigned long ret;
         ret = p[3];
@@ -131,15 +134,266 @@ pxbuf_check_finite(Pxbuf *pxbuf)
 }
 #endif
 
+/*
+ * Every normalization method boils down to a few steps like these,
+ * each done to every pixel alike once its parameters have been worked
+ * out from the whole picture.  The steps are kept in a list, so that a
+ * struct pxbuf_xform_t can work them out on one picture (say, a small
+ * preview) and then do the same thing to another (say, one band at a
+ * time of the full-size picture, which is too big to have all of).
+ */
+enum pxbuf_step_kind_t {
+        STEP_OFFSET,    /* x -= f */
+        STEP_CLAMP,     /* x = min(max(x, lo), hi) */
+        STEP_SCALE,     /* x = crop_255f(x * f) */
+        STEP_EQ,        /* histogram equalization */
+        STEP_NEGATE,    /* x = f - x, all channels */
+        STEP_CLIP,      /* x = crop_255f(x) */
+};
+
+struct pxbuf_step_t {
+        enum pxbuf_step_kind_t kind;
+        enum pxbuf_chan_t chan;
+        float f;
+        double lo, hi;
+        float maxl, range;
+        unsigned long cdf[256];
+};
+
+struct pxbuf_xform_t {
+        struct pxbuf_step_t *step;
+        size_t nstep;
+        size_t size;
+};
+
 /* helper to hist_eq */
 static float
-cdf_scale(float f, unsigned long *cdf, float maxl, float range)
+cdf_scale(float f, const unsigned long *cdf, float maxl, float range)
 {
         int v = crop_255((int)(f * 256.0 + 0.5));
         v = (cdf[v] - cdf[0]) * maxl / range;
         return crop_255f((double)v / 256.0);
 }
 
+static inline float
+step_one(const struct pxbuf_step_t *s, float x)
+{
+        switch (s->kind) {
+        case STEP_OFFSET:
+                return x - s->f;
+        case STEP_CLAMP:
+                if (x < s->lo)
+                        return s->lo;
+                else if (x > s->hi)
+                        return s->hi;
+                return x;
+        case STEP_SCALE:
+                return crop_255f(x * s->f);
+        case STEP_EQ:
+                return cdf_scale(x, s->cdf, s->maxl, s->range);
+        case STEP_NEGATE:
+                return s->f - x;
+        case STEP_CLIP:
+        default:
+                return crop_255f(x);
+        }
+}
+
+/*
+ * Do step @s to every @stride'th of @n values at @x.  The common steps
+ * get loops of their own, simple enough for the compiler to vectorize.
+ */
+static inline void
+step_loop(const struct pxbuf_step_t *s, float *x, size_t n, size_t stride)
+{
+        float f = s->f;
+        double lo = s->lo, hi = s->hi;
+        size_t i;
+
+        switch (s->kind) {
+        case STEP_OFFSET:
+                for (i = 0; i < n; i += stride)
+                        x[i] = x[i] - f;
+                break;
+        case STEP_CLAMP:
+                for (i = 0; i < n; i += stride) {
+                        float v = x[i];
+                        x[i] = v < lo ? (float)lo : (v > hi ? (float)hi : v);
+                }
+                break;
+        case STEP_SCALE:
+                for (i = 0; i < n; i += stride)
+                        x[i] = crop_255f(x[i] * f);
+                break;
+        case STEP_NEGATE:
+                for (i = 0; i < n; i += stride)
+                        x[i] = f - x[i];
+                break;
+        case STEP_CLIP:
+                for (i = 0; i < n; i += stride)
+                        x[i] = crop_255f(x[i]);
+                break;
+        default:
+                for (i = 0; i < n; i += stride)
+                        x[i] = step_one(s, x[i]);
+                break;
+        }
+}
+
+/* Do step @s to @npx pixels' worth of channels, starting at @x */
+static void
+step_block(const struct pxbuf_step_t *s, float *x, size_t npx)
+{
+        if (s->chan < 0)
+                step_loop(s, x, npx * 3, 1);
+        else
+                step_loop(s, &x[s->chan], npx * 3 - s->chan, 3);
+}
+
+/* Append @s to @xf */
+static void
+xform_add(struct pxbuf_xform_t *xf, const struct pxbuf_step_t *s)
+{
+        if (xf->nstep == xf->size) {
+                size_t size = xf->size ? xf->size * 2 : 4;
+                struct pxbuf_step_t *step;
+                step = realloc(xf->step, size * sizeof(*step));
+                if (!step) {
+                        fprintf(stderr, "OOM!\n");
+                        exit(EXIT_FAILURE);
+                }
+                xf->step = step;
+                xf->size = size;
+        }
+        xf->step[xf->nstep++] = *s;
+}
+
+/*
+ * Walking a big picture once per step is slow, and most of the steps
+ * need a walk of their own first to work out their parameters.  So
+ * within one pxbuf_normalize() the steps aren't done to the pixels as
+ * soon as they're worked out.  They wait in @pending, and each pass
+ * that gathers statistics for the next step does the pending ones on
+ * the fly to a copy of a few pixels at a time, which is still in cache.
+ * norm_flush() then does them all in one pass that writes the pixels.
+ *
+ * A pass is split into chunks of a fixed number of pixels, whose
+ * statistics are added up in order, so the sums come out the same
+ * however many threads did the chunks.
+ */
+enum {
+        NORM_CHUNK = 64 * 1024, /* pixels per task */
+        NORM_BLOCK = 1024,      /* pixels per step_block() */
+};
+
+/* What a pass gathers, or 0 to do the pending steps to the pixels */
+enum {
+        NORM_MINMAX     = 0x01,
+        NORM_MOMENTS    = 0x02,
+        NORM_HIST       = 0x04,
+};
+
+/*
+ * Statistics of one channel over part or all of the picture.  @m2 is the
+ * sum of squared differences from @sum / @n, kept that way instead of
+ * a sum of squares so that it can be added up in one pass without
+ * losing everything to rounding when the spread is small.
+ */
+struct norm_stats_t {
+        unsigned long n;
+        float min;
+        float max;
+        double sum;
+        double m2;
+        unsigned long hist[256];
+};
+
+struct norm_t {
+        Pxbuf *pxbuf;
+        struct pxbuf_xform_t pending;
+        struct pxbuf_xform_t *xf;       /* also save steps here if not NULL */
+        struct threadpool_t *pool;
+};
+
+struct norm_task_t {
+        struct norm_t *nm;
+        unsigned int want;
+        size_t start;
+        size_t end;
+        struct norm_stats_t st[3];
+};
+
+static struct threadpool_t *pxbuf_pool = NULL;
+
+/**
+ * pxbuf_set_pool - Let the pxbuf functions split big jobs up among
+ *                  the workers of @pool
+ * @pool: The program's thread pool, or NULL (the default) to do
+ *        everything in the calling thread.  It must not be destroyed
+ *        while it's still set, and nothing else may be waiting on it
+ *        while a pxbuf function runs.
+ */
+void
+pxbuf_set_pool(struct threadpool_t *pool)
+{
+        pxbuf_pool = pool;
+}
+
+/**
+ * pxbuf_get_pool - Get the pool set by pxbuf_set_pool(), if it has more
+ *                  than one worker to share with
+ *
+ * Return the pool, or NULL if there's no point in using one.
+ */
+struct threadpool_t *
+pxbuf_get_pool(void)
+{
+        if (!pxbuf_pool || threadpool_size(pxbuf_pool) < 2)
+                return NULL;
+        return pxbuf_pool;
+}
+
+static void
+stats_init(struct norm_stats_t *st, unsigned int want)
+{
+        st->n = 0;
+        st->min = INFINITY;
+        st->max = -INFINITY;
+        st->sum = 0.0;
+        st->m2 = 0.0;
+        if (want & NORM_HIST)
+                memset(st->hist, 0, sizeof(st->hist));
+}
+
+/* Add @src's statistics to @dst's, see Chan et al. for @m2 */
+static void
+stats_merge(struct norm_stats_t *dst, const struct norm_stats_t *src,
+            unsigned int want)
+{
+        int i;
+
+        if (dst->min > src->min)
+                dst->min = src->min;
+        if (dst->max < src->max)
+                dst->max = src->max;
+        if (!src->n) {
+                /* nothing to add */
+        } else if (!dst->n) {
+                dst->sum = src->sum;
+                dst->m2 = src->m2;
+        } else if (want & NORM_MOMENTS) {
+                double delta = src->sum / src->n - dst->sum / dst->n;
+                dst->m2 += src->m2 + delta * delta
+                           * ((double)dst->n * src->n / (dst->n + src->n));
+                dst->sum += src->sum;
+        }
+        dst->n += src->n;
+        if (want & NORM_HIST) {
+                for (i = 0; i < 256; i++)
+                        dst->hist[i] += src->hist[i];
+        }
+}
+
 /* Helper to hist_eq */
 static void
 save_to_hist(float f, unsigned long *hist)
@@ -148,262 +402,376 @@ save_to_hist(float f, unsigned long *hist)
         hist[v]++;
 }
 
+/* Gather @want of @npx pixels' worth of channels at @x into @st */
 static void
-hist_eq(Pxbuf *pxbuf, float max, enum pxbuf_chan_t chan)
+stats_block(struct norm_stats_t *st, const float *x, size_t npx,
+            unsigned int want)
 {
-        /* TODO: Implement this */
-        enum { HIST_SIZE = 256 };
-        unsigned long histogram[256];
-        unsigned long cdf[256];
-        unsigned long cdfmax, cdfrange;
-        struct pixel_t *px;
-        int i;
-        int maxl = crop_255((int)max * 256.0 + 0.5);
-
-        memset(histogram, 9, sizeof(histogram));
-        memset(cdf, 0, sizeof(cdf));
-
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        for (i = 0; i < 3; i++)
-                                save_to_hist(px->x[i], histogram);
-                } else {
-                        save_to_hist(px->x[chan], histogram);
+        float min[3] = { INFINITY, INFINITY, INFINITY };
+        float max[3] = { -INFINITY, -INFINITY, -INFINITY };
+        size_t i, n = npx * 3;
+        int c;
+
+        for (i = 0; i < n && (want & NORM_MINMAX); i += 3) {
+                for (c = 0; c < 3; c++) {
+                        if (max[c] < x[i + c])
+                                max[c] = x[i + c];
+                        if (min[c] > x[i + c])
+                                min[c] = x[i + c];
                 }
         }
-        cdfmax = 0;
-        for (i = 0; i < 256; i++) {
-                cdfmax += histogram[i];
-                cdf[i] = cdfmax;
-        }
 
-        /* TODO: Maybe slumpify */
-        cdfrange = cdfmax - cdf[0];
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        for (i = 0; i < 3; i++) {
-                                px->x[i] = cdf_scale(px->x[i],
-                                                cdf, maxl, cdfrange);
+        for (c = 0; c < 3; c++) {
+                struct norm_stats_t b;
+
+                stats_init(&b, 0);
+                b.n = npx;
+                b.min = min[c];
+                b.max = max[c];
+                if (want & NORM_MOMENTS) {
+                        double mean;
+                        for (i = c; i < n; i += 3)
+                                b.sum += x[i];
+                        mean = b.sum / npx;
+                        for (i = c; i < n; i += 3) {
+                                double diff = x[i] - mean;
+                                b.m2 += diff * diff;
                         }
+                }
+                if (want & NORM_HIST) {
+                        for (i = c; i < n; i += 3)
+                                save_to_hist(x[i], st[c].hist);
+                }
+                stats_merge(&st[c], &b, want & ~NORM_HIST);
+        }
+}
+
+static void
+norm_task(void *arg)
+{
+        struct norm_task_t *t = (struct norm_task_t *)arg;
+        const struct pxbuf_xform_t *pend = &t->nm->pending;
+        struct pixel_t *px = &t->nm->pxbuf->buf[t->start];
+        struct pixel_t *end = &t->nm->pxbuf->buf[t->end];
+        float tmp[NORM_BLOCK * 3];
+        size_t i;
+        int c;
+
+        for (c = 0; c < 3; c++)
+                stats_init(&t->st[c], t->want);
+
+        while (px < end) {
+                size_t npx = end - px;
+                float *x;
+
+                if (npx > NORM_BLOCK)
+                        npx = NORM_BLOCK;
+                if (t->want && pend->nstep) {
+                        memcpy(tmp, px, npx * sizeof(*px));
+                        x = tmp;
                 } else {
-                        px->x[chan] = cdf_scale(px->x[chan],
-                                                cdf, maxl, cdfrange);
+                        x = px->x;
                 }
+                for (i = 0; i < pend->nstep; i++)
+                        step_block(&pend->step[i], x, npx);
+                if (t->want)
+                        stats_block(t->st, x, npx, t->want);
+                px += npx;
         }
 }
 
 /*
- * Shift offset of @pxbuf, but only if its lowest
- * value is less than zero.  We'd rather not shift things
- * if everything is positive, becase after all it just
- * might be a bright image with no pure black in it.
- *
- * Return the maximum value found.
+ * Do one pass over the picture with the pending steps done to each
+ * value.  If @want is 0 the values are written back to the pixels;
+ * otherwise they are only looked at, and @st gets the statistics of
+ * each channel over the whole picture.
  */
-static float
-maybe_offset_correct(Pxbuf *pxbuf, bool force, enum pxbuf_chan_t chan)
+static void
+norm_pass(struct norm_t *nm, unsigned int want, struct norm_stats_t *st)
 {
-        float max = -INFINITY, min = INFINITY;
-        struct pixel_t *px;
-        int i;
+        size_t npx = (size_t)nm->pxbuf->width * nm->pxbuf->height;
+        size_t i, ntask = (npx + NORM_CHUNK - 1) / NORM_CHUNK;
+        struct norm_task_t *task;
+        int c;
+
+        if (want) {
+                for (c = 0; c < 3; c++)
+                        stats_init(&st[c], want);
+        } else if (!nm->pending.nstep) {
+                return;
+        }
+        if (!ntask)
+                return;
 
-        PXBUF_SANITY(pxbuf);
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        for (i = 0; i < 3; i++) {
-                                if (max < px->x[i])
-                                        max = px->x[i];
-                                if (min > px->x[i])
-                                        min = px->x[i];
-                        }
-                } else {
-                        if (max < px->x[chan])
-                                max = px->x[chan];
-                        if (min > px->x[chan])
-                                min = px->x[chan];
+        task = malloc(sizeof(*task) * ntask);
+        if (!task) {
+                fprintf(stderr, "OOM!\n");
+                exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < ntask; i++) {
+                task[i].nm    = nm;
+                task[i].want  = want;
+                task[i].start = i * NORM_CHUNK;
+                task[i].end   = i + 1 < ntask ? (i + 1) * NORM_CHUNK : npx;
+                if (!nm->pool
+                    || threadpool_submit(nm->pool, norm_task, &task[i]) < 0) {
+                        norm_task(&task[i]);
                 }
         }
+        if (nm->pool)
+                threadpool_wait(nm->pool);
 
-        PXBUF_SANITY(pxbuf);
-        if (force || min < 0.0) {
-                max -= min;
-                for_each_pixel(px, pxbuf) {
-                        if (chan < 0) {
-                                for (i = 0; i < 3; i++)
-                                        px->x[i] -= min;
-                        } else {
-                                px->x[chan] -= min;
-                        }
-                }
+        for (i = 0; i < ntask && want; i++) {
+                for (c = 0; c < 3; c++)
+                        stats_merge(&st[c], &task[i].st[c], want);
         }
+        free(task);
+}
+
+static void
+norm_init(struct norm_t *nm, Pxbuf *pxbuf, struct pxbuf_xform_t *xf)
+{
+        size_t npx = (size_t)pxbuf->width * pxbuf->height;
+
+        memset(nm, 0, sizeof(*nm));
+        nm->pxbuf = pxbuf;
+        nm->xf = xf;
+        if (npx > NORM_CHUNK)
+                nm->pool = pxbuf_get_pool();
         PXBUF_SANITY(pxbuf);
-        return max;
 }
 
-static float
-shave_outliers(Pxbuf *pxbuf, float max,
-                float deviation, enum pxbuf_chan_t chan)
+/* Add step @s, to be done to every pixel by norm_flush() */
+static void
+norm_add(struct norm_t *nm, const struct pxbuf_step_t *s)
 {
-        /* "n" instead of "n-1" because we have the whole population */
-        double divn = 1.0 / ((double)(pxbuf->height * pxbuf->width));
-        double mean, sumsq, stddev, sum, stdmin, stdmax;
-        struct pixel_t *px;
+        xform_add(&nm->pending, s);
+        if (nm->xf)
+                xform_add(nm->xf, s);
+}
 
-        if (chan >= 0)
-                divn /= 3.0;
+/* Do the pending steps, and clean up @nm */
+static void
+norm_flush(struct norm_t *nm)
+{
+        norm_pass(nm, 0, NULL);
+        free(nm->pending.step);
+        PXBUF_SANITY(nm->pxbuf);
+}
 
-        sum = 0.0;
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        int i;
-                        for (i = 0; i < 3; i++) {
-                                sum += px->x[i];
-                        }
-                } else {
-                        sum += px->x[chan];
-                }
+/*
+ * Put into @st the statistics of channel group @g: all three channels
+ * together if @linked, else just channel @g.  Also return the channel
+ * for that group's steps.
+ */
+static enum pxbuf_chan_t
+norm_group(const struct norm_stats_t *all, int g, bool linked,
+           unsigned int want, struct norm_stats_t *st)
+{
+        int c;
+
+        if (!linked) {
+                *st = all[g];
+                return g;
         }
-        mean = sum * divn;
-        /* offset correction should have occured before calling us */
-        assert(mean >= 0.0);
+        stats_init(st, want);
+        for (c = 0; c < 3; c++)
+                stats_merge(st, &all[c], want);
+        return PXBUF_ALLCHAN;
+}
 
-        sumsq = 0.0;
-        for_each_pixel(px, pxbuf) {
-                double diff;
-                if (chan < 0) {
-                        int i;
-                        for (i = 0; i < 3; i++) {
-                                diff = px->x[i] - mean;
-                                sumsq += diff * diff;
-                        }
-                } else {
-                        diff = px->x[chan] - mean;
-                        sumsq += diff * diff;
+static void
+hist_eq(struct norm_t *nm, const float *max, bool linked)
+{
+        /* TODO: Implement this */
+        enum { HIST_SIZE = 256 };
+        struct norm_stats_t all[3];
+        int g, ngroup = linked ? 1 : 3;
+
+        norm_pass(nm, NORM_HIST, all);
+        for (g = 0; g < ngroup; g++) {
+                unsigned long histogram[256];
+                unsigned long cdfmax, cdfrange;
+                struct pxbuf_step_t s = { .kind = STEP_EQ };
+                struct norm_stats_t st;
+                int i;
+                int maxl = crop_255((int)max[g] * 256.0 + 0.5);
+
+                s.chan = norm_group(all, g, linked, NORM_HIST, &st);
+                memset(histogram, 9, sizeof(histogram));
+                for (i = 0; i < 256; i++)
+                        histogram[i] += st.hist[i];
+
+                cdfmax = 0;
+                for (i = 0; i < 256; i++) {
+                        cdfmax += histogram[i];
+                        s.cdf[i] = cdfmax;
                 }
+
+                /* TODO: Maybe slumpify */
+                cdfrange = cdfmax - s.cdf[0];
+                s.maxl = maxl;
+                s.range = cdfrange;
+                norm_add(nm, &s);
         }
-        stddev = sqrt(sumsq * divn);
+}
 
-        /* define "outlier" as @deviation times the standard deviation */
-        stdmin = mean - deviation * stddev;
-        stdmax = mean + deviation * stddev;
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        int i;
-                        for (i = 0; i < 3; i++) {
-                                if (px->x[i] < stdmin)
-                                        px->x[i] = stdmin;
-                                else if (px->x[i] > stdmax)
-                                        px->x[i] = stdmax;
-                        }
-                } else {
-                        if (px->x[chan] < stdmin)
-                                px->x[chan] = stdmin;
-                        else if (px->x[chan] > stdmax)
-                                px->x[chan] = stdmax;
+/*
+ * Shift offset of @pxbuf, but only if its lowest
+ * value is less than zero.  We'd rather not shift things
+ * if everything is positive, becase after all it just
+ * might be a bright image with no pure black in it.
+ *
+ * Put the maximum value found into @max, for each channel
+ * if not @linked.
+ */
+static void
+maybe_offset_correct(struct norm_t *nm, bool force, bool linked, float *max)
+{
+        struct norm_stats_t all[3];
+        int g, ngroup = linked ? 1 : 3;
+
+        norm_pass(nm, NORM_MINMAX, all);
+        for (g = 0; g < ngroup; g++) {
+                struct pxbuf_step_t s = { .kind = STEP_OFFSET };
+                struct norm_stats_t st;
+
+                s.chan = norm_group(all, g, linked, NORM_MINMAX, &st);
+                max[g] = st.max;
+                if (force || st.min < 0.0) {
+                        s.f = st.min;
+                        max[g] -= st.min;
+                        norm_add(nm, &s);
                 }
         }
-        return stdmax;
 }
 
-/* Make sure every channel of every pixel is in range [0:1) */
 static void
-normalize_helper(Pxbuf *pxbuf, float max, enum pxbuf_chan_t chan)
+shave_outliers(struct norm_t *nm, float *max, float deviation, bool linked)
 {
-        struct pixel_t *px;
-        float range_mult;
+        /* "n" instead of "n-1" because we have the whole population */
+        double divn = 1.0 / ((double)(nm->pxbuf->height * nm->pxbuf->width));
+        struct norm_stats_t all[3];
+        int g, ngroup = linked ? 1 : 3;
 
-        if (max <= 0.0) {
-                /* Spinal Tap album cover */
-                range_mult = 0.0;
-        } else {
-                range_mult = 1.0 / max;
-                /* Unlikely, but just in case */
-                if (!isnormal(range_mult))
-                        range_mult = 0.0;
+        if (!linked)
+                divn /= 3.0;
+
+        norm_pass(nm, NORM_MOMENTS, all);
+        for (g = 0; g < ngroup; g++) {
+                double mean, sumsq, stddev, diff;
+                struct pxbuf_step_t s = { .kind = STEP_CLAMP };
+                struct norm_stats_t st;
+
+                s.chan = norm_group(all, g, linked, NORM_MOMENTS, &st);
+                mean = st.sum * divn;
+                /* offset correction should have occured before calling us */
+                assert(mean >= 0.0);
+
+                /* Squares about @mean, from the ones about the true mean */
+                diff = st.n ? st.sum / st.n - mean : 0.0;
+                sumsq = st.m2 + diff * diff * st.n;
+                stddev = sqrt(sumsq * divn);
+
+                /* "outlier" is @deviation times the standard deviation away */
+                s.lo = mean - deviation * stddev;
+                s.hi = mean + deviation * stddev;
+                norm_add(nm, &s);
+                max[g] = s.hi;
         }
+}
 
-        PXBUF_SANITY(pxbuf);
+/* Make sure every channel of every pixel is in range [0:1) */
+static void
+normalize_helper(struct norm_t *nm, const float *max, bool linked)
+{
+        int g, ngroup = linked ? 1 : 3;
 
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        px->x[0] = crop_255f(px->x[0] * range_mult);
-                        px->x[1] = crop_255f(px->x[1] * range_mult);
-                        px->x[2] = crop_255f(px->x[2] * range_mult);
+        for (g = 0; g < ngroup; g++) {
+                struct pxbuf_step_t s = { .kind = STEP_SCALE };
+                float range_mult;
+
+                if (max[g] <= 0.0) {
+                        /* Spinal Tap album cover */
+                        range_mult = 0.0;
                 } else {
-                        px->x[chan] = crop_255f(px->x[chan]
-                                                * range_mult);
+                        range_mult = 1.0 / max[g];
+                        /* Unlikely, but just in case */
+                        if (!isnormal(range_mult))
+                                range_mult = 0.0;
                 }
-        }
 
-        PXBUF_SANITY(pxbuf);
+                s.chan = linked ? PXBUF_ALLCHAN : g;
+                s.f = range_mult;
+                norm_add(nm, &s);
+        }
 }
 
 static void
-pxbuf_clip(Pxbuf *pxbuf, enum pxbuf_chan_t chan)
+pxbuf_clip(struct norm_t *nm, bool linked)
 {
-        struct pixel_t *px;
-        for_each_pixel(px, pxbuf) {
-                if (chan < 0) {
-                        px->x[0] = crop_255f(px->x[0]);
-                        px->x[1] = crop_255f(px->x[1]);
-                        px->x[2] = crop_255f(px->x[2]);
-                } else {
-                        px->x[chan] = crop_255f(px->x[chan]);
-                }
+        int g, ngroup = linked ? 1 : 3;
+
+        for (g = 0; g < ngroup; g++) {
+                struct pxbuf_step_t s = { .kind = STEP_CLIP };
+                s.chan = linked ? PXBUF_ALLCHAN : g;
+                norm_add(nm, &s);
         }
 }
 
+static void
+negate_helper(Pxbuf *pxbuf, struct pxbuf_xform_t *xf)
+{
+        struct pxbuf_step_t s = { .kind = STEP_NEGATE, .chan = -1 };
+        struct norm_t nm;
+
+        norm_init(&nm, pxbuf, xf);
+        maybe_offset_correct(&nm, false, true, &s.f);
+        norm_add(&nm, &s);
+        norm_flush(&nm);
+}
+
 void
 pxbuf_negate(Pxbuf *pxbuf)
 {
-        struct pixel_t *px;
-        float max;
-        PXBUF_SANITY(pxbuf);
-        max = maybe_offset_correct(pxbuf, false, -1);
-        /* Set to true only while debugging */
-        PXBUF_SANITY(pxbuf);
-        for_each_pixel(px, pxbuf) {
-                px->x[0] = max - px->x[0];
-                px->x[1] = max - px->x[1];
-                px->x[2] = max - px->x[2];
-        }
-        /* Set to true only while debugging */
-        PXBUF_SANITY(pxbuf);
+        negate_helper(pxbuf, NULL);
 }
 
+/*
+ * Channels that aren't @linked are done side by side rather than one
+ * after the other, so they all share each pass over the picture.
+ */
 static int
-pxbuf_normalize_helper(Pxbuf *pxbuf,
-        enum pxbuf_norm_t method, float deviation,
-        enum pxbuf_chan_t chan)
+normalize_xf(Pxbuf *pxbuf, enum pxbuf_norm_t method,
+             float deviation, bool linked, struct pxbuf_xform_t *xf)
 {
-        if (chan >= 3)
+        struct norm_t nm;
+        float max[3];
+
+        switch (method) {
+        case PXBUF_NORM_CLIP:
+        case PXBUF_NORM_CROP:
+        case PXBUF_NORM_FIT:
+        case PXBUF_NORM_SCALE:
+        case PXBUF_NORM_EQ:
+                break;
+        default:
                 return -1;
+        }
 
-        PXBUF_SANITY(pxbuf);
+        norm_init(&nm, pxbuf, xf);
         if (method == PXBUF_NORM_CLIP) {
-                pxbuf_clip(pxbuf, chan);
+                pxbuf_clip(&nm, linked);
         } else {
-                float max = maybe_offset_correct(pxbuf,
-                                        method == PXBUF_NORM_FIT,
-                                        chan);
-                PXBUF_SANITY(pxbuf);
-                switch (method) {
-                case PXBUF_NORM_CROP:
-                        max = shave_outliers(pxbuf, max, deviation, chan);
-                        normalize_helper(pxbuf, max, chan);
-                        break;
-                case PXBUF_NORM_FIT:
-                case PXBUF_NORM_SCALE:
-                        normalize_helper(pxbuf, max, chan);
-                        break;
-                case PXBUF_NORM_EQ:
-                        normalize_helper(pxbuf, max, chan);
-                        hist_eq(pxbuf, max, chan);
-                        break;
-                default:
-                        return -1;
-                }
+                maybe_offset_correct(&nm, method == PXBUF_NORM_FIT,
+                                     linked, max);
+                if (method == PXBUF_NORM_CROP)
+                        shave_outliers(&nm, max, deviation, linked);
+                normalize_helper(&nm, max, linked);
+                if (method == PXBUF_NORM_EQ)
+                        hist_eq(&nm, max, linked);
         }
+        norm_flush(&nm);
         return 0;
 }
 
@@ -411,48 +779,260 @@ int
 pxbuf_normalize(Pxbuf *pxbuf, enum pxbuf_norm_t method,
                 float deviation, bool linked)
 {
-        if (linked) {
-                return pxbuf_normalize_helper(pxbuf, method,
-                                                deviation, -1);
-        } else {
-                int i, res;
-                for (i = 0; i < 3; i++) {
-                        res = pxbuf_normalize_helper(
-                                        pxbuf, method, deviation, i);
-                        if (res != 0)
-                                return res;
+        return normalize_xf(pxbuf, method, deviation, linked, NULL);
+}
+
+/**
+ * pxbuf_xform_create - Get an empty transform, which does nothing
+ *
+ * Return the transform, or NULL if out of memory.
+ */
+struct pxbuf_xform_t *
+pxbuf_xform_create(void)
+{
+        struct pxbuf_xform_t *xf = malloc(sizeof(*xf));
+        if (!xf)
+                return NULL;
+        memset(xf, 0, sizeof(*xf));
+        return xf;
+}
+
+void
+pxbuf_xform_destroy(struct pxbuf_xform_t *xf)
+{
+        free(xf->step);
+        free(xf);
+}
+
+/**
+ * pxbuf_xform_normalize - pxbuf_normalize(), and remember how
+ * @xf: Transform to add to
+ * @pxbuf: Picture to normalize, the same as pxbuf_normalize()
+ *
+ * Whatever pxbuf_normalize() worked out from @pxbuf (its lowest and
+ * highest values, its histogram...), pxbuf_xform_apply() will use the
+ * same numbers, not work them out again from its own pxbuf.
+ */
+int
+pxbuf_xform_normalize(struct pxbuf_xform_t *xf, Pxbuf *pxbuf,
+                      enum pxbuf_norm_t method, float deviation,
+                      bool linked)
+{
+        return normalize_xf(pxbuf, method, deviation, linked, xf);
+}
+
+/**
+ * pxbuf_xform_negate - pxbuf_negate(), and remember how
+ */
+void
+pxbuf_xform_negate(struct pxbuf_xform_t *xf, Pxbuf *pxbuf)
+{
+        negate_helper(pxbuf, xf);
+}
+
+/**
+ * pxbuf_xform_apply - Do to @pxbuf what was done to the pxbuf(s)
+ *                     @xf was made from, in the same order
+ *
+ * All of the steps are done in one pass over @pxbuf.
+ */
+void
+pxbuf_xform_apply(const struct pxbuf_xform_t *xf, Pxbuf *pxbuf)
+{
+        struct norm_t nm;
+        size_t i;
+
+        norm_init(&nm, pxbuf, NULL);
+        for (i = 0; i < xf->nstep; i++)
+                norm_add(&nm, &xf->step[i]);
+        norm_flush(&nm);
+}
+
+/* BMP rows are padded to... well, not quite a multiple of four bytes */
+static int
+bmp_padding(int width)
+{
+        return (width * 3) % 4;
+}
+
+/* What pxbuf_read_from_bmp() needs to decode rows of a BMP */
+struct bmp_info_t {
+        Pxbuf *pxbuf;
+        const unsigned char *bits;      /* first row in the file */
+        size_t stride;                  /* bytes from one row to the next */
+        int bpp;                        /* bytes per pixel, 3 or 4 */
+        bool topdown;
+        bool bitfields;
+        /* For BI_BITFIELDS, indexed by enum pxbuf_chan_t */
+        unsigned long mask[3];
+        int shift[3];
+        float scale[3];
+};
+
+/* A range of rows for one thread to decode */
+struct bmp_task_t {
+        const struct bmp_info_t *bi;
+        int rowstart;
+        int rowend;
+};
+
+/*
+ * Decode row @row of the file into @bi->pxbuf.  Values go from 0 to
+ * 255, as they always have; it's up to the caller to normalize them.
+ */
+static void
+bmp_decode_row(const struct bmp_info_t *bi, int row)
+{
+        Pxbuf *pxbuf = bi->pxbuf;
+        const unsigned char *src = &bi->bits[row * bi->stride];
+        float *dst;
+        int col, i;
+
+        if (bi->topdown)
+                row = pxbuf->height - 1 - row;
+        dst = pxptr(pxbuf, row, 0)->x;
+
+        if (bi->bitfields) {
+                for (col = 0; col < pxbuf->width; col++, src += 4) {
+                        unsigned long v = unpack32(src);
+                        for (i = 0; i < 3; i++) {
+                                *dst++ = ((v & bi->mask[i]) >> bi->shift[i])
+                                         * bi->scale[i];
+                        }
+                }
+        } else if (bi->bpp == 4) {
+                /* BGRX, same order as pxbuf_t, ignore the X */
+                for (col = 0; col < pxbuf->width; col++, src += 4) {
+                        for (i = 0; i < 3; i++)
+                                *dst++ = src[i];
                 }
+        } else {
+                /* BGR, exactly as in pxbuf_t */
+                for (i = 0; i < pxbuf->width * 3; i++)
+                        dst[i] = src[i];
+        }
+}
+
+static void
+bmp_decode_task(void *arg)
+{
+        struct bmp_task_t *t = (struct bmp_task_t *)arg;
+        int row;
+        for (row = t->rowstart; row < t->rowend; row++)
+                bmp_decode_row(t->bi, row);
+}
+
+/* Decode every row, in the pxbuf_set_pool() pool if there is one */
+static void
+bmp_decode(const struct bmp_info_t *bi)
+{
+        struct threadpool_t *pool = pxbuf_get_pool();
+        struct bmp_task_t *task = NULL;
+        int height = bi->pxbuf->height;
+        int i, ntask;
+
+        /* A few tasks per thread, in case some threads get going late */
+        ntask = pool ? 4 * threadpool_size(pool) : 1;
+        if (ntask > height)
+                ntask = height;
+        if (ntask > 1)
+                task = malloc(sizeof(*task) * ntask);
+        if (!task) {
+                /* One thread, or it's all we could get */
+                struct bmp_task_t all = { bi, 0, height };
+                bmp_decode_task(&all);
+                return;
         }
+
+        for (i = 0; i < ntask; i++) {
+                task[i].bi       = bi;
+                task[i].rowstart = (long)height * i / ntask;
+                task[i].rowend   = (long)height * (i + 1) / ntask;
+                if (threadpool_submit(pool, bmp_decode_task, &task[i]) < 0)
+                        bmp_decode_task(&task[i]);
+        }
+        threadpool_wait(pool);
+        free(task);
+}
+
+/*
+ * Read the masks of a BI_BITFIELDS file, which come right after the
+ * 40-byte BITMAPINFOHEADER whether or not the header is bigger, red
+ * first.  Return -1 if any of them is empty.
+ */
+static int
+bmp_bitfields(struct bmp_info_t *bi, unsigned char *masks)
+{
+        static const int CHAN[3] = { PXBUF_RED, PXBUF_GREEN, PXBUF_BLUE };
+        int i;
+
+        for (i = 0; i < 3; i++) {
+                unsigned long m = unpack32(&masks[4 * i]);
+                int c = CHAN[i];
+                int shift = 0;
+
+                if (m == 0)
+                        return -1;
+                while (!(m & (1ul << shift)))
+                        shift++;
+                bi->mask[c]  = m;
+                bi->shift[c] = shift;
+                bi->scale[c] = 255.0f / (float)(m >> shift);
+        }
+        bi->bitfields = true;
         return 0;
 }
 
+/**
+ * pxbuf_read_from_bmp - Read a BMP file into a new pxbuf
+ * @fp: File to read, from the start
+ *
+ * This reads 24-bit BI_RGB and 32-bit BI_RGB or BI_BITFIELDS files,
+ * bottom-up or top-down, with any of the Windows info headers.  The
+ * file is mapped into memory rather than read into a buffer, if it
+ * can be, and its rows are decoded straight into the pxbuf, in the
+ * pxbuf_set_pool() pool if there is one.
+ *
+ * Channel values come out from 0 to 255, not normalized.
+ *
+ * Return the new pxbuf, or NULL if out of memory or the file is not
+ * a BMP we can read.
+ */
 Pxbuf *
 pxbuf_read_from_bmp(FILE *fp)
 {
         struct stat st;
-        unsigned char *buf, *p;
-        size_t nread, offset;
-        long width, height, row, col, padding;
-        Pxbuf *ret;
-
-        if (fstat(fileno(fp), &st) != 0)
+        struct bmp_info_t bi;
+        unsigned char *buf;
+        size_t size, offset, avail, rowlen;
+        long width, height;
+        unsigned long hdrsize, compression;
+        bool mapped = true;
+        Pxbuf *ret = NULL;
+
+        if (fstat(fileno(fp), &st) != 0 || st.st_size < 54)
                 return NULL;
+        size = st.st_size;
+        buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (buf == MAP_FAILED) {
+                /* Not something we can map, read it the old way */
+                mapped = false;
+                buf = malloc(size);
+                if (!buf)
+                        return NULL;
+                if (read(fileno(fp), buf, size) != size)
+                        goto out;
+        }
         /*
          * errno might have been set from rewind
          * if fp is stdin, so ignore it
          */
         errno = 0;
-        buf = malloc(st.st_size);
-        if (!buf)
-                return NULL;
-        nread = read(fileno(fp), buf, st.st_size);
-        if (nread != st.st_size)
-                goto err;
 
         /* Only support Windows-style BMP */
         if (buf[0] != 'B' || buf[1] != 'M') {
                 fprintf(stderr, "%d%d != BM\n", buf[0], buf[1]);
-                goto err;
+                goto out;
         }
 
         /*
@@ -460,55 +1040,92 @@ pxbuf_read_from_bmp(FILE *fp)
          * send us flying off the map.
          */
         offset = unpack32(&buf[10]);
-        if (offset > st.st_size)
-                goto err;
-
-        /* Only accept Windows BITMAPINFOHEADER */
-        if (unpack32(&buf[14]) != 40)
-                goto err;
+        if (offset > size)
+                goto out;
 
-        width = unpack32(&buf[18]);
-        height = unpack32(&buf[22]);
+        /*
+         * BITMAPINFOHEADER, or one of the later ones (V2 through V5)
+         * that start out the same
+         */
+        hdrsize = unpack32(&buf[14]);
+        if (hdrsize != 40 && hdrsize != 52 && hdrsize != 56
+            && hdrsize != 108 && hdrsize != 124) {
+                goto out;
+        }
+        if (14 + hdrsize > size)
+                goto out;
+
+        /* Negative height means the rows go top to bottom */
+        width = (int32_t)unpack32(&buf[18]);
+        height = (int32_t)unpack32(&buf[22]);
+        if (width <= 0 || height == 0)
+                goto out;
         if (unpack16(&buf[26]) != 1)
-                goto err;
-        /* Only accept 24-bit color depth */
-        if (unpack16(&buf[28]) != 24)
-                goto err;
-
-        /* Only accept BI_RGB compression */
-        if (unpack32(&buf[30]) != BI_RGB)
-                goto err;
+                goto out;
+
+        memset(&bi, 0, sizeof(bi));
+        bi.topdown = height < 0;
+        if (height < 0)
+                height = -height;
+        bi.bpp = unpack16(&buf[28]) / 8;
+        compression = unpack32(&buf[30]);
+        if (bi.bpp == 3 && compression == BI_RGB) {
+                ;
+        } else if (bi.bpp == 4 && compression == BI_RGB) {
+                ;
+        } else if (bi.bpp == 4 && compression == BI_BITFIELDS) {
+                if (14 + 40 + 12 > offset
+                    || bmp_bitfields(&bi, &buf[14 + 40]) < 0) {
+                        goto out;
+                }
+        } else {
+                goto out;
+        }
 
-        /* Sanity-check the buffer size */
-        if (((((3 * width) * 4) / 32) * height) > st.st_size)
-                goto err;
+        /*
+         * Rows are padded to a multiple of four bytes, except in our
+         * own 24-bit files, which pxbuf_bmp_write_rows() pads with
+         * bmp_padding() bytes instead.  Where that makes a difference,
+         * it makes the file a different size, which is how we tell.
+         */
+        rowlen = (size_t)width * bi.bpp;
+        bi.stride = (rowlen + 3) & ~(size_t)3;
+        avail = size - offset;
+        if (bi.bpp == 3
+            && avail == (rowlen + bmp_padding(width)) * height) {
+                bi.stride = rowlen + bmp_padding(width);
+        }
+        if (bi.stride * (height - 1) + rowlen > avail)
+                goto out;
+        bi.bits = &buf[offset];
 
         ret = pxbuf_create(width, height);
         if (!ret)
-                goto err;
-
-        padding = (width * 3) % 4;
-        p = &buf[offset];
-        for (row = 0; row < height; row++) {
-                for (col = 0; col < width; col++) {
-                        struct pixel_t *px;
-                        px = pxbuf_get_pixel(ret, row, col);
-                        /* TODO: is px BGR like BMP, or is it RGB? */
-                        px->x[0] = *p++;
-                        px->x[1] = *p++;
-                        px->x[2] = *p++;
-                }
-                p += padding;
-        }
+                goto out;
+        bi.pxbuf = ret;
+        bmp_decode(&bi);
+
+out:
+        if (mapped)
+                munmap(buf, size);
+        else
+                free(buf);
         return ret;
-
-err:
-        free(buf);
-        return NULL;
 }
 
+/**
+ * pxbuf_bmp_write_header - Start a BMP file
+ * @fp: File to write to
+ * @width: Width of the whole picture
+ * @height: Height of the whole picture
+ *
+ * Follow this with pxbuf_bmp_write_rows() for every row of the
+ * picture, in order, for a picture too big to have in one pxbuf.
+ *
+ * Return 0 if okay, -1 if there was a write error.
+ */
 int
-pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
+pxbuf_bmp_write_header(FILE *fp, int width, int height)
 {
         enum {
                 T_SIZE = 14, /* file header */
@@ -516,12 +1133,10 @@ pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
                 HDR_SIZE = DIB_SIZE + T_SIZE,
         };
         unsigned char buffer[HDR_SIZE];
-        int row, col;
         int depth = 3; /* plain-vanilla 24-bit rgb */
-        int padding = (pxbuf->width * depth) % 4;
-        int arr_size = (pxbuf->width * depth + padding) * pxbuf->height;
+        int padding = bmp_padding(width);
+        int arr_size = (width * depth + padding) * height;
         unsigned char *p;
-        struct pixel_t *px;
 
         /* Pack header buffer */
         p = buffer;
@@ -532,8 +1147,8 @@ pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
         p = pack32(p, HDR_SIZE);
         /* Pack dib */
         p = pack32(p, DIB_SIZE);
-        p = pack32(p, pxbuf->width);
-        p = pack32(p, pxbuf->height);
+        p = pack32(p, width);
+        p = pack32(p, height);
         p = pack16(p, 1);
         p = pack16(p, depth * 8);
         p = pack32(p, BI_RGB);
@@ -543,27 +1158,115 @@ pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
         p = pack32(p, 0);
         p = pack32(p, 0);
 
-        fwrite(buffer, sizeof(buffer), 1, fp);
-        /* repurpose buffer[] as our zero-padding write buffer */
-        memset(buffer, 0, sizeof(buffer));
-        assert(padding <= sizeof(buffer));
+        return fwrite(buffer, sizeof(buffer), 1, fp) == 1 ? 0 : -1;
+}
+
+/*
+ * Turn @n channel values into BMP bytes.  pxbuf_t keeps its channels
+ * in BGR order, same as BMP, so this is just one long run of floats to
+ * convert.  It's kept this simple so the compiler can do it several at
+ * a time in SIMD registers.
+ *
+ * Same rounding as (unsigned)(x * 256.0 + 0.5), cropped to 255, for
+ * all the values pxbuf_normalize() leaves behind.
+ */
+static void
+encode_bytes(unsigned char *dst, const float *src, size_t n)
+{
+        size_t i;
+        for (i = 0; i < n; i++) {
+                int v = (int)(src[i] * 256.0 + 0.5);
+                dst[i] = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+}
+
+/**
+ * pxbuf_bmp_write_rows - Write all of @pxbuf's rows to a BMP file
+ * @pxbuf: Rows to write, which may be just a band of the picture,
+ *         as wide as it is
+ * @fp: File started with pxbuf_bmp_write_header()
+ * @method: Normalization, as for pxbuf_print_to_bmp().  This only
+ *          looks at @pxbuf, so if it's a band, use PXBUF_NORM_CLIP
+ *          and normalize with a struct pxbuf_xform_t first.
+ *
+ * Rows are encoded into a buffer of about BMP_BLOCK bytes, and written
+ * a buffer at a time, rather than one fwrite() per pixel.
+ *
+ * Return 0 if okay, -1 if out of memory or there was a write error.
+ */
+int
+pxbuf_bmp_write_rows(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
+{
+        enum { BMP_BLOCK = 1024 * 1024 };
+        size_t rowlen = pxbuf->width * 3 + bmp_padding(pxbuf->width);
+        size_t nrow = BMP_BLOCK / rowlen;
+        unsigned char *buf;
+        int row, ret = 0;
+
+        if (nrow < 1)
+                nrow = 1;
+        if (nrow > pxbuf->height)
+                nrow = pxbuf->height;
+        buf = malloc(rowlen * nrow);
+        if (!buf)
+                return -1;
+        /* Zero the padding once, it never gets written over */
+        memset(buf, 0, rowlen * nrow);
 
         pxbuf_normalize(pxbuf, method, 3.0, PXBUF_ALLCHAN);
-        for (row = 0; row < pxbuf->height; row++) {
-                for (col = 0; col < pxbuf->width; col++) {
-                        unsigned char rgb[3];
-                        px = pxptr(pxbuf, row, col);
-                        /* Weird.  BMP orders it BGR instead of RGB */
-                        rgb[0] = crop_255((px->x[PXBUF_BLUE] * 256.0 + 0.5));
-                        rgb[1] = crop_255((px->x[PXBUF_GREEN] * 256.0 + 0.5));
-                        rgb[2] = crop_255((px->x[PXBUF_RED] * 256.0 + 0.5));
-
-                        fwrite(rgb, 3, 1, fp);
+        for (row = 0; row < pxbuf->height; row += nrow) {
+                size_t i, n = nrow;
+                if (n > pxbuf->height - row)
+                        n = pxbuf->height - row;
+                for (i = 0; i < n; i++) {
+                        encode_bytes(&buf[i * rowlen],
+                                     pxptr(pxbuf, row + i, 0)->x,
+                                     pxbuf->width * 3);
+                }
+                if (fwrite(buf, rowlen, n, fp) != n) {
+                        ret = -1;
+                        break;
                 }
-                if (padding)
-                        fwrite(buffer, 1, padding, fp);
         }
-        return 0;
+        free(buf);
+        return ret;
+}
+
+int
+pxbuf_print_to_bmp(Pxbuf *pxbuf, FILE *fp, enum pxbuf_norm_t method)
+{
+        if (pxbuf_bmp_write_header(fp, pxbuf->width, pxbuf->height) < 0)
+                return -1;
+        return pxbuf_bmp_write_rows(pxbuf, fp, method);
+}
+
+/**
+ * pxbuf_format - Kind of file to write to @path, going by its extension
+ *
+ * Anything other than ".png" (in either case) is a BMP.
+ */
+enum pxbuf_format_t
+pxbuf_format(const char *path)
+{
+        const char *ext = strrchr(path, '.');
+        if (ext && !strcasecmp(ext, ".png"))
+                return PXBUF_PNG;
+        return PXBUF_BMP;
+}
+
+/**
+ * pxbuf_print - Write @pxbuf to @fp as a @format file
+ * @depth: Bits per channel for PNG, 8 or 16.  BMP is always 8.
+ *
+ * See pxbuf_print_to_bmp() and pxbuf_print_to_png().
+ */
+int
+pxbuf_print(Pxbuf *pxbuf, FILE *fp, enum pxbuf_format_t format,
+            enum pxbuf_norm_t method, int depth)
+{
+        if (format == PXBUF_PNG)
+                return pxbuf_print_to_png(pxbuf, fp, method, depth);
+        return pxbuf_print_to_bmp(pxbuf, fp, method);
 }
 
 Pxbuf *
@@ -572,15 +1275,18 @@ pxbuf_create(int width, int height)
         Pxbuf *ret = malloc(sizeof(*ret));
         if (!ret)
                 return NULL;
-        ret->buf = malloc(sizeof(*(ret->buf)) * width * height);
+        /*
+         * Initialize every pixel to 0.0.  For a big pxbuf, calloc()
+         * gets pages the kernel has already zeroed, so they don't get
+         * touched until they're used, by whichever thread uses them.
+         */
+        ret->buf = calloc((size_t)width * height, sizeof(*ret->buf));
         if (!ret->buf) {
                 free(ret);
                 return NULL;
         }
         ret->width = width;
         ret->height = height;
-        /* Initialize every pixel to 0.0 */
-        memset(ret->buf, 0, sizeof(*ret->buf) * width * height);
         PXBUF_SANITY(ret);
         return ret;
 }
@@ -0,0 +1,254 @@
+/*
+ * threadpool.c - A fixed set of worker threads, shared by the programs
+ *                that want to split up their work.
+ *
+ * The workers are started once, when the pool is created, and then wait
+ * around for tasks.  threadpool_wait() is the barrier: it returns when
+ * every task submitted so far has finished.  That way a program that
+ * renders more than once (mbrot2 --subdivide=verify, for example) does
+ * not have to create and join a new set of threads for each render.
+ *
+ * Without pthreads, the pool has no workers at all, and
+ * threadpool_submit() just runs the task right away.
+ */
+#define _GNU_SOURCE /* for CPU_SET() and pthread_setaffinity_np() */
+#include "config.h"
+#include "fractal_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if EGFRACTAL_MULTITHREADED
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+struct tp_task_t {
+        void (*fn)(void *);
+        void *arg;
+        struct tp_task_t *next;
+};
+
+struct threadpool_t {
+        int nthread;
+#if EGFRACTAL_MULTITHREADED
+        pthread_t *id;
+        pthread_mutex_t lock;
+        pthread_cond_t work;    /* a task was queued, or we're stopping */
+        pthread_cond_t idle;    /* @pending went to zero */
+        struct tp_task_t *head;
+        struct tp_task_t *tail;
+        unsigned long pending;  /* tasks queued plus tasks running */
+        bool stop;
+#endif
+};
+
+/**
+ * threadpool_ncpu - Number of CPUs online
+ */
+int
+threadpool_ncpu(void)
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (int)n : 1;
+}
+
+/**
+ * threadpool_size - Number of tasks @pool can run at the same time
+ */
+int
+threadpool_size(const struct threadpool_t *pool)
+{
+        return pool->nthread;
+}
+
+#if EGFRACTAL_MULTITHREADED
+
+static void *
+tp_worker(void *arg)
+{
+        struct threadpool_t *pool = arg;
+
+        pthread_mutex_lock(&pool->lock);
+        for (;;) {
+                struct tp_task_t *task;
+
+                while (!pool->head && !pool->stop)
+                        pthread_cond_wait(&pool->work, &pool->lock);
+                if (!pool->head)
+                        break;
+
+                task = pool->head;
+                pool->head = task->next;
+                if (!pool->head)
+                        pool->tail = NULL;
+
+                pthread_mutex_unlock(&pool->lock);
+                task->fn(task->arg);
+                free(task);
+                pthread_mutex_lock(&pool->lock);
+
+                if (--pool->pending == 0)
+                        pthread_cond_broadcast(&pool->idle);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+}
+
+static void
+tp_set_affinity(pthread_t id, int cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        /* Not fatal, it's only a hint anyway */
+        if (pthread_setaffinity_np(id, sizeof(set), &set) != 0)
+                fprintf(stderr, "Cannot pin thread to CPU %d\n", cpu);
+#endif
+}
+
+/**
+ * threadpool_create - Start a pool of worker threads
+ * @nthread: Number of workers, or zero or less to use one per online CPU
+ * @affinity: True to pin worker number i to CPU number i (modulo the
+ *            number of CPUs), false to let the scheduler move them
+ *            around.
+ *
+ * Return the new pool, or NULL if we could not allocate it or start
+ * its threads.
+ */
+struct threadpool_t *
+threadpool_create(int nthread, bool affinity)
+{
+        struct threadpool_t *pool;
+        int i, ncpu = threadpool_ncpu();
+
+        if (nthread <= 0)
+                nthread = ncpu;
+
+        pool = malloc(sizeof(*pool));
+        if (!pool)
+                return NULL;
+        memset(pool, 0, sizeof(*pool));
+        pool->id = malloc(sizeof(*pool->id) * nthread);
+        if (!pool->id) {
+                free(pool);
+                return NULL;
+        }
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work, NULL);
+        pthread_cond_init(&pool->idle, NULL);
+
+        for (i = 0; i < nthread; i++) {
+                if (pthread_create(&pool->id[i], NULL,
+                                   tp_worker, pool) != 0) {
+                        break;
+                }
+                if (affinity)
+                        tp_set_affinity(pool->id[i], i % ncpu);
+        }
+        pool->nthread = i;
+        if (i < nthread) {
+                threadpool_destroy(pool);
+                return NULL;
+        }
+        return pool;
+}
+
+/**
+ * threadpool_submit - Queue up fn(arg) to be run by the next free worker
+ *
+ * Return 0 if queued, -1 if out of memory.
+ */
+int
+threadpool_submit(struct threadpool_t *pool, void (*fn)(void *), void *arg)
+{
+        struct tp_task_t *task = malloc(sizeof(*task));
+        if (!task)
+                return -1;
+        task->fn   = fn;
+        task->arg  = arg;
+        task->next = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->tail)
+                pool->tail->next = task;
+        else
+                pool->head = task;
+        pool->tail = task;
+        pool->pending++;
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+}
+
+/**
+ * threadpool_wait - Wait for every submitted task to finish
+ */
+void
+threadpool_wait(struct threadpool_t *pool)
+{
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending > 0)
+                pthread_cond_wait(&pool->idle, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * threadpool_destroy - Finish any queued tasks, then stop the workers
+ *                      and free @pool
+ */
+void
+threadpool_destroy(struct threadpool_t *pool)
+{
+        int i;
+
+        threadpool_wait(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < pool->nthread; i++)
+                pthread_join(pool->id[i], NULL);
+
+        pthread_cond_destroy(&pool->idle);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->id);
+        free(pool);
+}
+
+#else /* !EGFRACTAL_MULTITHREADED */
+
+struct threadpool_t *
+threadpool_create(int nthread, bool affinity)
+{
+        struct threadpool_t *pool = malloc(sizeof(*pool));
+        if (pool)
+                pool->nthread = 1;
+        return pool;
+}
+
+int
+threadpool_submit(struct threadpool_t *pool, void (*fn)(void *), void *arg)
+{
+        /* Nobody else to do it, so do it now */
+        fn(arg);
+        return 0;
+}
+
+void
+threadpool_wait(struct threadpool_t *pool)
+{
+        return;
+}
+
+void
+threadpool_destroy(struct threadpool_t *pool)
+{
+        free(pool);
+}
+
+#endif /* !EGFRACTAL_MULTITHREADED */
@@ -0,0 +1,55 @@
+/*
+ * tileq.c - Hand out tiles of an image to worker threads.
+ *
+ * See the comment above struct tileq_t in fractal_common.h.
+ */
+#include "fractal_common.h"
+
+/**
+ * tileq_init_band - Set up @q to hand out rows @rowstart up to but not
+ *                   including @rowend of a @width-wide image
+ *
+ * The tiles line up with @rowstart, not with row zero.
+ */
+void
+tileq_init_band(struct tileq_t *q, int width, int rowstart, int rowend)
+{
+        unsigned int nrow = (rowend - rowstart + TILE_SIZE - 1) / TILE_SIZE;
+        q->ncol   = (width + TILE_SIZE - 1) / TILE_SIZE;
+        q->ntile  = q->ncol * nrow;
+        q->next   = 0;
+        q->width  = width;
+        q->rowstart = rowstart;
+        q->height = rowend;
+}
+
+/**
+ * tileq_init - Set up @q to hand out a @width x @height image
+ */
+void
+tileq_init(struct tileq_t *q, int width, int height)
+{
+        tileq_init_band(q, width, 0, height);
+}
+
+/*
+ * Claim the next unclaimed tile from @q and store its bounds in @tile.
+ * Return false if the whole image has already been handed out.
+ */
+bool
+tileq_next(struct tileq_t *q, struct tile_t *tile)
+{
+        unsigned int idx = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+        if (idx >= q->ntile)
+                return false;
+
+        tile->rowstart = q->rowstart + (idx / q->ncol) * TILE_SIZE;
+        tile->colstart = (idx % q->ncol) * TILE_SIZE;
+        tile->rowend = tile->rowstart + TILE_SIZE;
+        if (tile->rowend > q->height)
+                tile->rowend = q->height;
+        tile->colend = tile->colstart + TILE_SIZE;
+        if (tile->colend > q->width)
+                tile->colend = q->width;
+        return true;
+}
@@ -0,0 +1,149 @@
+/*
+ * antialias.c - Adaptive anti-aliasing for mbrot2 (--aa)
+ *
+ * One sample per pixel makes jaggies wherever the colors change
+ * quickly: along the edge of the set, and across the thin filaments
+ * and tight bands around it.  Rendering the whole image N times bigger
+ * and shrinking it fixes that, but costs N*N times as much, and most
+ * of the image is smooth enough not to need it.
+ *
+ * So this is a second pass over the finished first one.  A pixel gets
+ * resampled only if its palette position (see color_index()) is more
+ * than --aa-threshold entries away from one of its four neighbors', or
+ * if one of them is inside the set and the other isn't.  It then gets
+ * N*N new samples, one at a random spot in each cell of an N x N grid
+ * over the pixel, and its color is the average of theirs.  The colors
+ * are averaged rather than the iteration counts, since the palette
+ * wraps around: halfway between two counts can be a color neither
+ * of them is.
+ *
+ * The random spots come from a hash of the pixel and sample number, so
+ * the image doesn't depend on which thread did which tile.
+ */
+#include "mandelbrot_common.h"
+#include <math.h>
+
+/* splitmix64's finalizer, good enough for jitter */
+static inline uint64_t
+aa_hash(uint64_t x)
+{
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+}
+
+/* Palette position of pixel @row, @col from the first pass */
+static inline mfloat_t
+aa_index(struct aa_info_t *ai, int row, int col)
+{
+        struct thread_info_t *ti = &ai->ti;
+        return color_index(ti->buf[(row - ti->row0) * ti->width + col],
+                           ai->min, ai->max);
+}
+
+/* True if pixel @row, @col differs enough from a neighbor to resample */
+static bool
+aa_needed(struct aa_info_t *ai, int row, int col)
+{
+        static const int NEIGHBOR[4][2] = {
+                { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 },
+        };
+        struct thread_info_t *ti = &ai->ti;
+        mfloat_t v = aa_index(ai, row, col);
+        int i;
+
+        for (i = 0; i < 4; i++) {
+                int r = row + NEIGHBOR[i][0];
+                int c = col + NEIGHBOR[i][1];
+                mfloat_t vn;
+
+                if (r < 0 || r >= ti->height || c < 0 || c >= ti->width)
+                        continue;
+                vn = aa_index(ai, r, c);
+                if ((v < 0.0L) != (vn < 0.0L))
+                        return true;
+                if (v >= 0.0L && fabs(v - vn) > gbl.aa_threshold)
+                        return true;
+        }
+        return false;
+}
+
+/* Give pixel @row, @col the average color of gbl.aa squared samples */
+static void
+aa_pixel(struct aa_info_t *ai, int row, int col)
+{
+        struct thread_info_t *ti = &ai->ti;
+        unsigned int n = gbl.aa;
+        uint64_t seed = ((uint64_t)row * ti->width + col) * n * n;
+        mfloat_t ninv = 1.0L / (mfloat_t)n;
+        double sum[3] = { 0.0, 0.0, 0.0 };
+        struct pixel_t px;
+        unsigned int i, j, k;
+
+        for (i = 0; i < n; i++) {
+                for (j = 0; j < n; j++) {
+                        uint64_t h = aa_hash(seed + i * n + j);
+                        mfloat_t dr = (mfloat_t)(h >> 32) / 4294967296.0L;
+                        mfloat_t dc = (mfloat_t)(h & 0xffffffffu)
+                                      / 4294967296.0L;
+                        mfloat_t v;
+
+                        /* Spot in cell i,j, centered on the pixel */
+                        dr = ((mfloat_t)i + dr) * ninv - 0.5L;
+                        dc = ((mfloat_t)j + dc) * ninv - 0.5L;
+                        v = mbrot_sample(ti, (mfloat_t)row + dr,
+                                         (mfloat_t)col + dc);
+
+                        /* -D colors only go from first pass's min to max */
+                        if (gbl.distance_est && v >= 0.0L) {
+                                if (v > ai->max)
+                                        v = ai->max;
+                                else if (v < ai->min)
+                                        v = ai->min;
+                        }
+                        get_color(v, ai->min, ai->max, &px);
+                        for (k = 0; k < 3; k++)
+                                sum[k] += px.x[k];
+                }
+        }
+        for (k = 0; k < 3; k++)
+                px.x[k] = sum[k] / (double)(n * n);
+        pxbuf_set_pixel(ai->pxbuf, &px, row - ai->pxrow0, col);
+}
+
+/**
+ * aa_thread - Thread pool task for the --aa pass, one per worker
+ * @arg: Pointer to a struct aa_info_t
+ *
+ * The first pass's colors must already be in the pxbuf.  Only the
+ * pixels that need it are overwritten.
+ */
+void
+aa_thread(void *arg)
+{
+        struct aa_info_t *ai = (struct aa_info_t *)arg;
+        struct thread_info_t *ti = &ai->ti;
+        struct tile_t tile;
+
+        while (tileq_next(ti->tileq, &tile)) {
+                unsigned long niter = ti->stats.niter;
+                int row, col;
+
+                for (row = tile.rowstart; row < tile.rowend; row++) {
+                        for (col = tile.colstart; col < tile.colend; col++) {
+                                if (!aa_needed(ai, row, col))
+                                        continue;
+                                aa_pixel(ai, row, col);
+                                ai->nrefined++;
+                        }
+                }
+
+                if (ti->progress) {
+                        progress_add(ti->progress,
+                                     (tile.rowend - tile.rowstart)
+                                     * (tile.colend - tile.colstart),
+                                     ti->stats.niter - niter);
+                }
+        }
+}
@@ -0,0 +1,279 @@
+/*
+ * bigfix.c - Just enough fixed-point bignum math for a perturbation
+ *            reference orbit.
+ *
+ * A bigfix_t is sign-and-magnitude.  The magnitude is stored in
+ * little-endian 32-bit limbs, with the most significant limb holding
+ * the integer part and the rest holding the fraction.  That's plenty
+ * of integer part for the Mandelbrot set, where everything we care
+ * about has a modulus less than the bailout radius.
+ *
+ * The number of limbs is the same for every number, and it's set once
+ * with bigfix_set_precision() before doing any math.  Nothing here is
+ * thread-safe, but we only ever calculate one reference orbit at a time.
+ */
+#include "mandelbrot_common.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+static int nlimb = 2;
+
+/* Integer part is in l[nlimb - 1] */
+#define INT_LIMB (nlimb - 1)
+
+/**
+ * bigfix_set_precision - Set precision for all future bigfix math
+ * @fracbits: Minimum number of bits after the point.
+ *
+ * Return the actual number of bits after the point, which may be more
+ * than @fracbits.
+ */
+int
+bigfix_set_precision(int fracbits)
+{
+        nlimb = 1 + (fracbits + 31) / 32;
+        if (nlimb < 3)
+                nlimb = 3;
+        if (nlimb > BIGFIX_MAXLIMB)
+                nlimb = BIGFIX_MAXLIMB;
+        return (nlimb - 1) * 32;
+}
+
+void
+bigfix_zero(struct bigfix_t *a)
+{
+        memset(a, 0, sizeof(*a));
+}
+
+static int
+mag_cmp(const struct bigfix_t *a, const struct bigfix_t *b)
+{
+        int i;
+        for (i = nlimb - 1; i >= 0; i--) {
+                if (a->l[i] != b->l[i])
+                        return a->l[i] > b->l[i] ? 1 : -1;
+        }
+        return 0;
+}
+
+/* |dst| = |a| + |b|.  @dst may alias either. */
+static void
+mag_add(struct bigfix_t *dst, const struct bigfix_t *a,
+        const struct bigfix_t *b)
+{
+        uint64_t carry = 0;
+        int i;
+        for (i = 0; i < nlimb; i++) {
+                carry += (uint64_t)a->l[i] + b->l[i];
+                dst->l[i] = (uint32_t)carry;
+                carry >>= 32;
+        }
+}
+
+/* |dst| = |a| - |b|, where |a| >= |b|.  @dst may alias either. */
+static void
+mag_sub(struct bigfix_t *dst, const struct bigfix_t *a,
+        const struct bigfix_t *b)
+{
+        int64_t borrow = 0;
+        int i;
+        for (i = 0; i < nlimb; i++) {
+                int64_t v = (int64_t)a->l[i] - b->l[i] - borrow;
+                borrow = v < 0;
+                dst->l[i] = (uint32_t)(v + (borrow << 32));
+        }
+}
+
+static void
+signed_add(struct bigfix_t *dst, const struct bigfix_t *a,
+           const struct bigfix_t *b, bool bneg)
+{
+        if (a->neg == bneg) {
+                mag_add(dst, a, b);
+                dst->neg = bneg;
+        } else if (mag_cmp(a, b) >= 0) {
+                bool neg = a->neg;
+                mag_sub(dst, a, b);
+                dst->neg = neg;
+        } else {
+                mag_sub(dst, b, a);
+                dst->neg = bneg;
+        }
+}
+
+/* dst = a + b.  @dst may alias either. */
+void
+bigfix_add(struct bigfix_t *dst, const struct bigfix_t *a,
+           const struct bigfix_t *b)
+{
+        signed_add(dst, a, b, b->neg);
+}
+
+/* dst = a - b.  @dst may alias either. */
+void
+bigfix_sub(struct bigfix_t *dst, const struct bigfix_t *a,
+           const struct bigfix_t *b)
+{
+        signed_add(dst, a, b, !b->neg);
+}
+
+/*
+ * dst = a * b, truncated to our precision.  @dst may alias either.
+ * The integer part of the result had better fit in 32 bits.
+ */
+void
+bigfix_mul(struct bigfix_t *dst, const struct bigfix_t *a,
+           const struct bigfix_t *b)
+{
+        uint32_t prod[2 * BIGFIX_MAXLIMB];
+        int i, j;
+
+        memset(prod, 0, sizeof(uint32_t) * 2 * nlimb);
+        for (i = 0; i < nlimb; i++) {
+                uint64_t carry = 0;
+                if (a->l[i] == 0)
+                        continue;
+                for (j = 0; j < nlimb; j++) {
+                        carry += (uint64_t)a->l[i] * b->l[j] + prod[i + j];
+                        prod[i + j] = (uint32_t)carry;
+                        carry >>= 32;
+                }
+                prod[i + nlimb] = (uint32_t)carry;
+        }
+
+        /*
+         * @prod has twice as many fraction limbs as we want,
+         * so drop the bottom nlimb - 1 of them.
+         */
+        dst->neg = a->neg != b->neg;
+        memcpy(dst->l, &prod[nlimb - 1], sizeof(uint32_t) * nlimb);
+}
+
+/* dst = a * m, for small integer @m */
+static void
+mul_small(struct bigfix_t *dst, const struct bigfix_t *a, uint32_t m)
+{
+        uint64_t carry = 0;
+        int i;
+        for (i = 0; i < nlimb; i++) {
+                carry += (uint64_t)a->l[i] * m;
+                dst->l[i] = (uint32_t)carry;
+                carry >>= 32;
+        }
+        dst->neg = a->neg;
+}
+
+/* dst = a / d, for small integer @d */
+static void
+div_small(struct bigfix_t *dst, const struct bigfix_t *a, uint32_t d)
+{
+        uint64_t rem = 0;
+        int i;
+        for (i = nlimb - 1; i >= 0; i--) {
+                rem = (rem << 32) | a->l[i];
+                dst->l[i] = (uint32_t)(rem / d);
+                rem %= d;
+        }
+        dst->neg = a->neg;
+}
+
+void
+bigfix_from_double(struct bigfix_t *dst, double v)
+{
+        int i;
+
+        bigfix_zero(dst);
+        if (v < 0.0) {
+                dst->neg = true;
+                v = -v;
+        }
+        /* double only has 53 bits, so three limbs covers it */
+        for (i = INT_LIMB; i >= 0 && i > INT_LIMB - 4; i--) {
+                double whole = floor(v);
+                dst->l[i] = (uint32_t)whole;
+                v = (v - whole) * 4294967296.0;
+        }
+}
+
+double
+bigfix_to_double(const struct bigfix_t *a)
+{
+        double ret = 0.0;
+        double scale = 1.0;
+        int i;
+        for (i = INT_LIMB; i >= 0 && i > INT_LIMB - 4; i--) {
+                ret += (double)a->l[i] * scale;
+                scale /= 4294967296.0;
+        }
+        return a->neg ? -ret : ret;
+}
+
+/**
+ * bigfix_parse - Parse a decimal string into a bigfix_t
+ * @dst: Where to store the result
+ * @s: String like "-0.14000524460488" or "1.2e-5"
+ *
+ * Unlike strtold(), this keeps every digit the user typed in (up to
+ * our precision), which is the whole point of deep zooms.
+ *
+ * Return 0 if all of @s was a number, -1 if not.
+ */
+int
+bigfix_parse(struct bigfix_t *dst, const char *s)
+{
+        const char *frac, *end;
+        bool neg = false;
+        unsigned long ipart = 0;
+        long exp = 0;
+        int ndigit = 0;
+
+        bigfix_zero(dst);
+        while (isspace((unsigned char)*s))
+                s++;
+        if (*s == '-' || *s == '+')
+                neg = *s++ == '-';
+
+        while (isdigit((unsigned char)*s)) {
+                ipart = ipart * 10 + (*s++ - '0');
+                if (ipart > 0xffffu)
+                        return -1;
+                ndigit++;
+        }
+        frac = end = s;
+        if (*s == '.') {
+                frac = ++s;
+                while (isdigit((unsigned char)*s)) {
+                        s++;
+                        ndigit++;
+                }
+                end = s;
+        }
+        if (ndigit == 0)
+                return -1;
+        if (*s == 'e' || *s == 'E') {
+                char *ep;
+                exp = strtol(s + 1, &ep, 10);
+                if (ep == s + 1)
+                        return -1;
+                s = ep;
+        }
+        if (*s != '\0')
+                return -1;
+
+        /* Fraction, from the last digit backward: x = (d + x) / 10 */
+        while (end > frac) {
+                --end;
+                dst->l[INT_LIMB] = *end - '0';
+                div_small(dst, dst, 10);
+        }
+        dst->l[INT_LIMB] = ipart;
+
+        for (; exp < 0; exp++)
+                div_small(dst, dst, 10);
+        for (; exp > 0; exp--)
+                mul_small(dst, dst, 10);
+
+        dst->neg = neg;
+        return 0;
+}
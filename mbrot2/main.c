@@ -37,13 +37,11 @@
 #include <math.h>
 #include <string.h>
 #include <errno.h>
-#if EGFRACTAL_MULTITHREADED
-#include <pthread.h>
-#endif
 
 struct gbl_t gbl = {
         .n_iteration    = 1000,
-        .nthread        = 4,
+        .nthread        = 0,
+        .affinity       = false,
         .dither         = 0,
         .height         = 600,
         .width          = 600,
@@ -51,9 +49,15 @@ struct gbl_t gbl = {
         .zoom_pct       = 1.0,
         .zoom_xoffs     = 0.0,
         .zoom_yoffs     = 0.0,
+        .xoffs_str      = NULL,
+        .yoffs_str      = NULL,
         .bailout        = 2.0,
         .bailoutsqu     = 4.0,
         .min_iteration  = 0,
+        .aa             = 1,
+        .band           = 0,
+        .depth          = 8,
+        .aa_threshold   = 2.0,
         .distance_est   = false,
         .verbose        = false,
         .color_distance = false,
@@ -61,6 +65,12 @@ struct gbl_t gbl = {
         .distance_root  = 0.25,
         .negate         = false,
         .linked         = false,
+        .simd           = true,
+        .subdivide      = false,
+        .verify         = false,
+        .perturb        = false,
+        .series         = true,
+        .progressive    = false,
         .formula        = NULL,
         .log_d          = 0.0,
         .redspread      = 1.0,
@@ -76,224 +86,614 @@ oom(void)
         exit(EXIT_FAILURE);
 }
 
-#if EGFRACTAL_MULTITHREADED
+/* Worker threads, shared by every render */
+static struct threadpool_t *pool;
 
-/* XXX Place up at top of file */
-struct thread_helper_t {
-        pthread_t *id;
-        pthread_attr_t attr;
-};
+/* Reference orbit for --perturb, shared by every pass, or NULL */
+static struct ref_orbit_t *ref;
 
 static void
-init_thread_helper(struct thread_helper_t *helper, int nthread)
+ref_orbit_setup(void)
 {
-        helper->id = malloc(sizeof(*helper->id) * nthread);
-        if (!helper->id)
-                oom();
-        if (pthread_attr_init(&helper->attr) != 0) {
-                perror("pthread_attr_init error");
-                exit(EXIT_FAILURE);
-        }
-}
+        mfloat_t pixel_size = 4.0L * gbl.zoom_pct / (mfloat_t)gbl.width;
 
-static void
-join_threads(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int nthread)
-{
-        int i;
-        int res = pthread_attr_destroy(&helper->attr);
-        if (res != 0) {
-                perror("pthread_attr_destroy error");
-                exit(EXIT_FAILURE);
-        }
-        for (i = 0; i < nthread; i++) {
-                void *s;
-                res = pthread_join(helper->id[i], &s);
-                if (res != 0 || s != NULL) {
-                        fprintf(stderr, "pthread_join[%d] failed (%s)\n",
-                                i, strerror(errno));
-                        fprintf(stderr, "Continuing anyway\n");
+        if (gbl.perturb) {
+                ref = ref_orbit_create(pixel_size);
+                if (!ref)
+                        oom();
+                if (gbl.series)
+                        ref_orbit_series(ref, pixel_size);
+                if (gbl.verbose) {
+                        printf("Reference orbit: %lu iterations, %d bits\n",
+                               ref->len - 1, ref->bits);
+                        printf("Series approximation skipped %lu iterations\n",
+                               ref->skip);
                 }
+        } else if (zoom_too_deep(pixel_size)) {
+                fprintf(stderr, "Warning: Zoom is too deep for "
+                        "double precision; try --perturb\n");
         }
-
 }
 
-static void
-create_thread(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int threadno)
+/* True if the pixels go through the vectorized escape-time kernel */
+static bool
+use_simd(void)
 {
-        int res = pthread_create(&helper->id[threadno],
-                        &helper->attr, &mbrot_thread, &ti[threadno]);
-        if (res != 0) {
-                perror("pthread_create error");
-                exit(EXIT_FAILURE);
-        }
+        return gbl.simd && !gbl.formula && !gbl.distance_est && !gbl.perturb;
 }
 
-static void
-free_thread_helper(struct thread_helper_t *helper)
-{
-        free(helper->id);
-}
-
-#else /* !EGFRACTAL_MULTITHREADED */
-
-struct thread_helper_t {
-        int dummy;
+/*
+ * struct band_t - The part of the picture a pass works on
+ * @width: Width of the picture
+ * @height: Height of the whole picture, not just the band.  This is
+ *          usually gbl.height, but a preview can be smaller.
+ * @rowstart: First row of the band, and the first row in the buffer
+ * @rowend: One past the last row of the band
+ */
+struct band_t {
+        int width;
+        int height;
+        int rowstart;
+        int rowend;
 };
 
+/* The whole picture, at full size */
 static void
-init_thread_helper(struct thread_helper_t *helper, int nthread)
+band_whole(struct band_t *band)
 {
-        return;
+        band->width    = gbl.width;
+        band->height   = gbl.height;
+        band->rowstart = 0;
+        band->rowend   = gbl.height;
 }
 
+/* Set up a thread's info for a pass over @band, kept in @tbuf */
 static void
-join_threads(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int nthread)
+thread_info_init(struct thread_info_t *ti, mfloat_t *tbuf,
+                 const struct band_t *band, struct tileq_t *tileq,
+                 struct progress_t *progress, bool subdivide)
 {
-        /* Only one thread, so call it directly */
-        mbrot_thread(&ti[0]);
-}
+        ti->min          = 1.0e16;
+        ti->max          = 0.0;
+        ti->bailoutsqu   = gbl.bailoutsqu;
+        ti->log_d        = gbl.log_d;
+        ti->distance_est = gbl.distance_est;
+        ti->dither       = gbl.dither;
+        ti->simd         = use_simd();
+        ti->ref          = ref;
+        ti->nrebase      = 0;
+        ti->stats.nperiodic = 0;
+        ti->stats.niter  = 0;
+        ti->progress     = progress;
+        ti->subdivide    = subdivide;
+        ti->stride       = 1;
+        ti->prev_stride  = 0;
+        ti->nfilled      = 0;
+        ti->tileq        = tileq;
+        ti->height       = band->height;
+        ti->width        = band->width;
+        ti->row0         = band->rowstart;
 
-static void
-create_thread(struct thread_helper_t *helper,
-                struct thread_info_t *ti, int threadno)
-{
-        return;
+#if OLD_XY_TO_COMPLEX
+        ti->zoom_pct     = gbl.zoom_pct;
+        ti->zoom_yoffs   = gbl.zoom_yoffs;
+        ti->zoom_xoffs   = gbl.zoom_xoffs;
+#endif
+        ti->formula      = gbl.formula;
+        ti->dformula     = gbl.dformula;
+        ti->n_iteration  = gbl.n_iteration;
+        ti->w4 = 4.0L * gbl.zoom_pct / (mfloat_t)band->width;
+        ti->h4 = 4.0L * gbl.zoom_pct / (mfloat_t)band->height;
+        ti->zx = 2.0L * gbl.zoom_pct - gbl.zoom_xoffs;
+        ti->zy = 2.0L * gbl.zoom_pct - gbl.zoom_yoffs;
+        ti->zoom2 = 2.0L * gbl.zoom_pct;
+        ti->period_eps = period_eps(fmin(ti->w4, ti->h4));
+        /*
+         * Every thread writes straight into @tbuf.  They
+         * never touch the same tile, so no need to lock it.
+         */
+        ti->buf          = tbuf;
 }
 
-static void
-free_thread_helper(struct thread_helper_t *helper)
+/* Number of pixels on a grid of every @stride'th pixel */
+static unsigned long
+grid_size(int stride)
 {
-        return;
+        return (unsigned long)((gbl.width + stride - 1) / stride)
+               * ((gbl.height + stride - 1) / stride);
 }
 
-#endif /* !EGFRACTAL_MULTITHREADED */
-
-void
-mbrot_get_data(mfloat_t *tbuf, mfloat_t *min, mfloat_t *max, int nthread)
+/*
+ * Calculate every @stride'th pixel of @band in each direction, except
+ * every @prev_stride'th, which are already done (0 to do them all),
+ * into @tbuf.  @min and @max get the range of the pixels done this
+ * time.  If @progress is NULL, keep our own progress meter and print
+ * stats if --verbose; otherwise add to @progress and keep quiet.
+ */
+static void
+mbrot_get_data(mfloat_t *tbuf, const struct band_t *band,
+               mfloat_t *min, mfloat_t *max, bool subdivide,
+               int stride, int prev_stride, struct progress_t *progress)
 {
-        int nrows = gbl.height / nthread;
-        int i;
+        unsigned long nfilled, nrebase, nperiodic, npx;
         struct thread_info_t *ti;
-        struct thread_helper_t helper;
+        struct tileq_t tileq;
+        struct progress_t myprogress;
+        bool quiet = progress != NULL || !gbl.verbose;
+        int nthread = threadpool_size(pool);
+        int i;
 
         ti = malloc(sizeof(*ti) * nthread);
         if (!ti)
                 oom();
 
-        if (nrows <= 0) {
-                fprintf(stderr,
-                        "Error: height cannot be more than "
-                        "the number of threads\n");
-                exit(EXIT_FAILURE);
+        npx = (unsigned long)band->width * (band->rowend - band->rowstart);
+        if (stride > 1 || prev_stride) {
+                /* Only the progressive passes, which are never bands */
+                npx = grid_size(stride);
+                if (prev_stride)
+                        npx -= grid_size(prev_stride);
         }
-
-        if (nrows * nthread != gbl.height) {
-                fprintf(stderr,
-                        "Warning: Cannot create image of height=%u;"
-                        " instead cropping to height=%u\n",
-                        gbl.height, nrows * nthread);
-                /*
-                 * No need to realloc tbuf, because for int,
-                 * (a / b) * b <= a, always.
-                 */
-                gbl.height = nrows * nthread;
+        tileq_init_band(&tileq, band->width, band->rowstart, band->rowend);
+        if (!quiet) {
+                progress_init(&myprogress, "px", npx);
+                progress = &myprogress;
         }
 
-        init_thread_helper(&helper, nthread);
-
         for (i = 0; i < nthread; i++) {
-                ti[i].min          = 1.0e16;
-                ti[i].max          = 0.0;
-                ti[i].bailoutsqu   = gbl.bailoutsqu;
-                ti[i].log_d        = gbl.log_d;
-                ti[i].distance_est = gbl.distance_est;
-                ti[i].dither       = gbl.dither;
-                ti[i].skip         = nthread;
-                ti[i].rowstart     = i;
-                ti[i].rowend       = gbl.height;
-
-#if OLD_XY_TO_COMPLEX
-                ti[i].height       = gbl.height;
-                ti[i].width        = gbl.width;
-                ti[i].zoom_pct     = gbl.zoom_pct;
-                ti[i].zoom_yoffs   = gbl.zoom_yoffs;
-                ti[i].zoom_xoffs   = gbl.zoom_xoffs;
-#endif
-                ti[i].colstart     = 0;
-                ti[i].colend       = gbl.width;
-                ti[i].formula      = gbl.formula;
-                ti[i].dformula     = gbl.dformula;
-                ti[i].n_iteration  = gbl.n_iteration;
-                ti[i].w4 = 4.0L * gbl.zoom_pct / (mfloat_t)gbl.width;
-                ti[i].h4 = 4.0L * gbl.zoom_pct / (mfloat_t)gbl.height;
-                ti[i].zx = 2.0L * gbl.zoom_pct - gbl.zoom_xoffs;
-                ti[i].zy = 2.0L * gbl.zoom_pct - gbl.zoom_yoffs;
-                ti[i].bufsize = sizeof(mfloat_t) * gbl.width * nrows;
-                ti[i].buf = malloc(ti[i].bufsize);
-                if (!ti[i].buf)
+                thread_info_init(&ti[i], tbuf, band, &tileq,
+                                 progress, subdivide);
+                ti[i].stride      = stride;
+                ti[i].prev_stride = prev_stride;
+                if (threadpool_submit(pool, mbrot_thread, &ti[i]) < 0)
                         oom();
-
-                create_thread(&helper, ti, i);
         }
-        join_threads(&helper, ti, nthread);
+        threadpool_wait(pool);
 
-        /* Combine the threads' interleaved buffers */
         if (min)
                 *min = INFINITY;
         if (max)
                 *max = -INFINITY;
+        nfilled = nrebase = nperiodic = 0;
         for (i = 0; i < nthread; i++) {
-                int row, col;
-                mfloat_t *src = ti[i].buf;
-                for (row = i; row < gbl.height; row += nthread) {
-                        mfloat_t *dst = &tbuf[row * gbl.width];
-                        for(col = 0; col < gbl.width; col++)
-                                *dst++ = *src++;
-                }
                 if (min && *min > ti[i].min)
                         *min = ti[i].min;
                 if (max && *max < ti[i].max)
                         *max = ti[i].max;
-
-                free(ti[i].buf);
+                nfilled += ti[i].nfilled;
+                nrebase += ti[i].nrebase;
+                nperiodic += ti[i].stats.nperiodic;
         }
         free(ti);
-        free_thread_helper(&helper);
+        if (quiet)
+                return;
+
+        progress_done(&myprogress);
+        printf("Periodicity check caught %lu pixels\n", nperiodic);
+        if (subdivide) {
+                printf("Subdivision filled in %lu of %lu pixels\n",
+                       nfilled, npx);
+        }
+        if (ref)
+                printf("Perturbation rebased %lu times\n", nrebase);
 }
 
+/*
+ * Resample the pixels from @rowstart up to @rowend that stand out from
+ * their neighbors, and overwrite their colors in @pxbuf, whose first
+ * row is @rowstart.  @tbuf holds @band, which has to include the rows
+ * just above and below, if there are any.  See antialias.c.
+ *
+ * If @nrefined is NULL, print how many pixels were resampled if
+ * --verbose; otherwise add it to @nrefined and keep quiet.
+ */
 static void
-mandelbrot(Pxbuf *pxbuf)
+mbrot_antialias(mfloat_t *tbuf, const struct band_t *band,
+                int rowstart, int rowend, Pxbuf *pxbuf,
+                mfloat_t min, mfloat_t max, unsigned long *nrefined)
 {
-        int row, col;
-        mfloat_t *ptbuf, *tbuf, min, max;
+        unsigned long n = 0;
+        unsigned long npx = (unsigned long)band->width * (rowend - rowstart);
+        struct aa_info_t *ai;
+        struct tileq_t tileq;
+        struct progress_t progress;
+        bool quiet = nrefined != NULL || !gbl.verbose;
+        int nthread = threadpool_size(pool);
+        int i;
 
-        tbuf = malloc(gbl.width * gbl.height * sizeof(*tbuf));
-        if (!tbuf)
+        ai = malloc(sizeof(*ai) * nthread);
+        if (!ai)
                 oom();
 
-        mbrot_get_data(tbuf, &min, &max, gbl.nthread);
+        tileq_init_band(&tileq, band->width, rowstart, rowend);
+        if (!quiet)
+                progress_init(&progress, "px", npx);
 
-        printf("min: %Lg max: %Lg\n", (long double)min, (long double)max);
-        ptbuf = tbuf;
-        for (row = 0; row < gbl.height; row++) {
-                for (col = 0; col < gbl.width; col++) {
+        for (i = 0; i < nthread; i++) {
+                thread_info_init(&ai[i].ti, tbuf, band, &tileq,
+                                 quiet ? NULL : &progress, false);
+                ai[i].pxbuf    = pxbuf;
+                ai[i].pxrow0   = rowstart;
+                ai[i].min      = min;
+                ai[i].max      = max;
+                ai[i].nrefined = 0;
+                if (threadpool_submit(pool, aa_thread, &ai[i]) < 0)
+                        oom();
+        }
+        threadpool_wait(pool);
+
+        for (i = 0; i < nthread; i++)
+                n += ai[i].nrefined;
+        free(ai);
+        if (nrefined)
+                *nrefined += n;
+        if (quiet)
+                return;
+
+        progress_done(&progress);
+        printf("Anti-aliasing resampled %lu of %lu pixels\n", n, npx);
+}
+
+/*
+ * Render the whole image again the long way and tell the user how
+ * much the --subdivide result in @tbuf differs from it.
+ */
+static void
+verify_subdivide(mfloat_t *tbuf)
+{
+        size_t i, npx = (size_t)gbl.width * gbl.height;
+        unsigned long ndiff = 0;
+        mfloat_t maxdiff = 0.0;
+        struct band_t whole;
+        mfloat_t *full;
+
+        full = malloc(npx * sizeof(*full));
+        if (!full)
+                oom();
+
+        band_whole(&whole);
+        mbrot_get_data(full, &whole, NULL, NULL, false, 1, 0, NULL);
+        for (i = 0; i < npx; i++) {
+                if (tbuf[i] != full[i]) {
+                        mfloat_t diff = fabs(tbuf[i] - full[i]);
+                        ndiff++;
+                        if (maxdiff < diff)
+                                maxdiff = diff;
+                }
+        }
+        fprintf(stderr, "Verify: %lu of %lu pixels differ from full render",
+                ndiff, (unsigned long)npx);
+        if (ndiff)
+                fprintf(stderr, " (max difference %Lg)", (long double)maxdiff);
+        fputc('\n', stderr);
+        if (ndiff && (gbl.dither & 02))
+                fprintf(stderr, "(Expected, since -d2 dithers randomly)\n");
+        free(full);
+}
+
+/*
+ * Color rows @rowstart up to @rowend of @pxbuf, whose first row is
+ * @rowstart, from @tbuf, which holds @band.  Only every @stride'th
+ * pixel in each direction has to have been calculated; the rest get
+ * the color of the one above and to the left of them.
+ */
+static void
+color_pxbuf(Pxbuf *pxbuf, mfloat_t *tbuf, const struct band_t *band,
+            int rowstart, int rowend, int stride,
+            mfloat_t min, mfloat_t max)
+{
+        int row, col;
+
+        for (row = rowstart; row < rowend; row++) {
+                mfloat_t *ptbuf = &tbuf[(row - row % stride - band->rowstart)
+                                        * band->width];
+                for (col = 0; col < band->width; col++) {
                         /*
                          * FIXME: need to completely re-design
                          * palette.c to use arrays of struct pixel_t,
                          * for precision's sake.
                          */
-                        mfloat_t v = *ptbuf++;
+                        mfloat_t v = ptbuf[col - col % stride];
                         struct pixel_t px;
+
+                        /* Only for --band, whose min and max are a guess */
+                        if (gbl.distance_est && v >= 0.0L) {
+                                if (v > max)
+                                        v = max;
+                                else if (v < min)
+                                        v = min;
+                        }
                         get_color(v, min, max, &px);
-                        pxbuf_set_pixel(pxbuf, &px, row, col);
+                        pxbuf_set_pixel(pxbuf, &px, row - rowstart, col);
+                }
+        }
+}
+
+/* Normalize @pxbuf the way the command line asked for */
+static void
+finish_pxbuf(Pxbuf *pxbuf)
+{
+        int i;
+        for (i = 0; i < gbl.nnorm; i++) {
+                pxbuf_normalize(pxbuf, gbl.norm_method[i],
+                        gbl.norm_scale[i], gbl.linked);
+        }
+        if (gbl.negate)
+                pxbuf_negate(pxbuf);
+}
+
+/*
+ * Save a --progressive preview to @path.  It's written to a temporary
+ * file and renamed, so that an image viewer watching @path never sees
+ * half a picture.  Failing isn't fatal; there's still the final image.
+ */
+static void
+write_preview(Pxbuf *pxbuf, const char *path, int stride)
+{
+        size_t len = strlen(path);
+        char *tmp;
+        FILE *fp;
+
+        tmp = malloc(len + 5);
+        if (!tmp)
+                oom();
+        memcpy(tmp, path, len);
+        strcpy(&tmp[len], ".tmp");
+
+        fp = fopen(tmp, "wb");
+        if (!fp)
+                goto err;
+        if (pxbuf_print(pxbuf, fp, pxbuf_format(path), PXBUF_NORM_CLIP,
+                        gbl.depth) < 0) {
+                fclose(fp);
+                goto err;
+        }
+        if (fclose(fp) != 0 || rename(tmp, path) < 0)
+                goto err;
+        printf("Wrote 1/%d preview to %s\n", stride * stride, path);
+        fflush(stdout);
+        free(tmp);
+        return;
+
+err:
+        fprintf(stderr, "Cannot save preview %s: %s\n",
+                path, strerror(errno));
+        remove(tmp);
+        free(tmp);
+}
+
+/*
+ * Render the image into @pxbuf.  If @preview is not NULL, do it
+ * coarse to fine: every fourth pixel each way, then every second,
+ * then the rest, saving a preview to @preview after each of the
+ * first two.  Every pixel is still only calculated once.
+ */
+static void
+mandelbrot(Pxbuf *pxbuf, const char *preview)
+{
+        static const int STRIDES[] = { 4, 2, 1 };
+        mfloat_t *tbuf, min, max;
+        struct band_t whole;
+        int i, prev;
+
+        tbuf = malloc(gbl.width * gbl.height * sizeof(*tbuf));
+        if (!tbuf)
+                oom();
+
+        if (gbl.verbose && use_simd())
+                printf("Using %s escape-time kernel\n", escape_isa_name());
+
+        band_whole(&whole);
+        ref_orbit_setup();
+        if (preview) {
+                min = INFINITY;
+                max = -INFINITY;
+                prev = 0;
+                for (i = 0; i < sizeof(STRIDES) / sizeof(STRIDES[0]); i++) {
+                        int stride = STRIDES[i];
+                        mfloat_t lmin, lmax;
+
+                        mbrot_get_data(tbuf, &whole, &lmin, &lmax, false,
+                                       stride, prev, NULL);
+                        if (min > lmin)
+                                min = lmin;
+                        if (max < lmax)
+                                max = lmax;
+                        if (stride > 1) {
+                                color_pxbuf(pxbuf, tbuf, &whole, 0,
+                                            gbl.height, stride, min, max);
+                                finish_pxbuf(pxbuf);
+                                write_preview(pxbuf, preview, stride);
+                        }
+                        prev = stride;
                 }
+        } else {
+                mbrot_get_data(tbuf, &whole, &min, &max, gbl.subdivide,
+                               1, 0, NULL);
+                if (gbl.subdivide && gbl.verify)
+                        verify_subdivide(tbuf);
+        }
+
+        printf("min: %Lg max: %Lg\n", (long double)min, (long double)max);
+        color_pxbuf(pxbuf, tbuf, &whole, 0, gbl.height, 1, min, max);
+        if (gbl.aa > 1) {
+                mbrot_antialias(tbuf, &whole, 0, gbl.height, pxbuf,
+                                min, max, NULL);
+        }
+        if (ref) {
+                ref_orbit_destroy(ref);
+                ref = NULL;
         }
         free(tbuf);
 }
 
+/*
+ * Work out min, max, and how to normalize from a small preview of the
+ * picture, at most PREVIEW_MAX pixels on a side, and save the latter
+ * in @xf.  If the picture is no bigger than that, the "preview" is the
+ * picture itself, so the numbers are exact.
+ */
+static void
+band_stats(struct pxbuf_xform_t *xf, mfloat_t *min, mfloat_t *max)
+{
+        enum { PREVIEW_MAX = 1024 };
+        int big = gbl.width > gbl.height ? gbl.width : gbl.height;
+        int scale = (big + PREVIEW_MAX - 1) / PREVIEW_MAX;
+        struct band_t pv;
+        mfloat_t *tbuf;
+        Pxbuf *pxbuf;
+        int i;
+
+        pv.width    = (gbl.width + scale - 1) / scale;
+        pv.height   = (gbl.height + scale - 1) / scale;
+        pv.rowstart = 0;
+        pv.rowend   = pv.height;
+
+        tbuf = malloc(sizeof(*tbuf) * pv.width * pv.height);
+        pxbuf = pxbuf_create(pv.width, pv.height);
+        if (!tbuf || !pxbuf)
+                oom();
+
+        if (gbl.verbose) {
+                printf("Getting stats from a %dx%d preview\n",
+                       pv.width, pv.height);
+        }
+        mbrot_get_data(tbuf, &pv, min, max, false, 1, 0, NULL);
+        color_pxbuf(pxbuf, tbuf, &pv, 0, pv.height, 1, *min, *max);
+        if (gbl.aa > 1) {
+                mbrot_antialias(tbuf, &pv, 0, pv.height, pxbuf,
+                                *min, *max, NULL);
+        }
+
+        for (i = 0; i < gbl.nnorm; i++) {
+                pxbuf_xform_normalize(xf, pxbuf, gbl.norm_method[i],
+                                      gbl.norm_scale[i], gbl.linked);
+        }
+        if (gbl.negate)
+                pxbuf_xform_negate(xf, pxbuf);
+
+        pxbuf_destroy(pxbuf);
+        free(tbuf);
+}
+
+/*
+ * --band: Render the picture @nrow rows at a time, writing each band
+ * to @path as soon as it's done, so that only one band at a time has
+ * to be in memory.  The numbers that take the whole picture to work
+ * out (min and max for -D, and whatever -N needs) come from a small
+ * preview first; see band_stats().
+ *
+ * With --aa, each band is rendered with an extra row above and below,
+ * so the pixels on its edges can be compared with their neighbors.
+ *
+ * A PNG goes from the top down, so for one, the bands are done in the
+ * opposite order.
+ */
+static void
+mandelbrot_bands(const char *path, int nrow)
+{
+        struct pxbuf_xform_t *xf;
+        struct pxbuf_png_t *png = NULL;
+        struct progress_t progress;
+        unsigned long nrefined = 0;
+        unsigned long total;
+        mfloat_t *tbuf, min, max;
+        int halo = gbl.aa > 1 ? 1 : 0;
+        int nband = (gbl.height + nrow - 1) / nrow;
+        int i;
+        FILE *fp;
+
+        if (gbl.verbose && use_simd())
+                printf("Using %s escape-time kernel\n", escape_isa_name());
+
+        ref_orbit_setup();
+        xf = pxbuf_xform_create();
+        if (!xf)
+                oom();
+        band_stats(xf, &min, &max);
+        printf("min: %Lg max: %Lg\n", (long double)min, (long double)max);
+
+        fp = fopen(path, "wb");
+        if (!fp) {
+                fprintf(stderr, "Cannot open output file `%s'\n", path);
+                exit(EXIT_FAILURE);
+        }
+        if (pxbuf_format(path) == PXBUF_PNG) {
+                png = pxbuf_png_start(fp, gbl.width, gbl.height,
+                                      gbl.depth);
+                if (!png)
+                        goto err;
+        } else if (pxbuf_bmp_write_header(fp, gbl.width, gbl.height) < 0) {
+                goto err;
+        }
+
+        tbuf = malloc(sizeof(*tbuf) * gbl.width * (nrow + 2 * halo));
+        if (!tbuf)
+                oom();
+
+        /* Every row, plus the extra ones between bands */
+        total = (unsigned long)gbl.width
+                * (gbl.height + 2 * halo * (nband - 1));
+        if (gbl.verbose)
+                progress_init(&progress, "px", total);
+
+        for (i = 0; i < nband; i++) {
+                int row = (png ? nband - 1 - i : i) * nrow;
+                int rowend = row + nrow;
+                struct band_t band;
+                Pxbuf *pxbuf;
+                int ret;
+
+                if (rowend > gbl.height)
+                        rowend = gbl.height;
+                band.width    = gbl.width;
+                band.height   = gbl.height;
+                band.rowstart = row > 0 ? row - halo : row;
+                band.rowend   = rowend < gbl.height ? rowend + halo : rowend;
+
+                pxbuf = pxbuf_create(gbl.width, rowend - row);
+                if (!pxbuf)
+                        oom();
+                mbrot_get_data(tbuf, &band, NULL, NULL, gbl.subdivide,
+                               1, 0, gbl.verbose ? &progress : NULL);
+                color_pxbuf(pxbuf, tbuf, &band, row, rowend, 1, min, max);
+                if (gbl.aa > 1) {
+                        mbrot_antialias(tbuf, &band, row, rowend, pxbuf,
+                                        min, max, &nrefined);
+                }
+                pxbuf_xform_apply(xf, pxbuf);
+                if (png)
+                        ret = pxbuf_png_write_rows(png, pxbuf, PXBUF_NORM_CLIP);
+                else
+                        ret = pxbuf_bmp_write_rows(pxbuf, fp, PXBUF_NORM_CLIP);
+                if (ret < 0)
+                        goto err;
+                pxbuf_destroy(pxbuf);
+        }
+        if (gbl.verbose) {
+                progress_done(&progress);
+                if (gbl.aa > 1) {
+                        printf("Anti-aliasing resampled %lu of %lu pixels\n",
+                               nrefined,
+                               (unsigned long)gbl.width * gbl.height);
+                }
+        }
+
+        if ((png && pxbuf_png_finish(png) < 0) || fclose(fp) != 0)
+                goto err;
+        free(tbuf);
+        pxbuf_xform_destroy(xf);
+        if (ref) {
+                ref_orbit_destroy(ref);
+                ref = NULL;
+        }
+        return;
+
+err:
+        fprintf(stderr, "Cannot write `%s'\n", path);
+        exit(EXIT_FAILURE);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -301,7 +701,7 @@ main(int argc, char **argv)
                 .outfile = "mandelbrot.bmp",
                 .print_palette = false,
         };
-        Pxbuf *pxbuf;
+        Pxbuf *pxbuf = NULL;
         FILE *fp;
 
         /* need to set these "consts" first */
@@ -309,16 +709,33 @@ main(int argc, char **argv)
 
         parse_args(argc, argv, &optflags);
 
-        pxbuf = pxbuf_create(gbl.width, gbl.height);
-        if (!pxbuf)
-                oom();
+        /* A full-size pxbuf is just what --band is meant to avoid */
+        if (!gbl.band || optflags.print_palette) {
+                pxbuf = pxbuf_create(gbl.width, gbl.height);
+                if (!pxbuf)
+                        oom();
+        }
 
         /*
          * Do this before fopen(), because we could be here for a very
          * time, and it's impolite to have a file open for that long.
          */
-        if (!optflags.print_palette)
-                mandelbrot(pxbuf);
+        if (!optflags.print_palette) {
+                pool = threadpool_create(gbl.nthread, gbl.affinity);
+                if (!pool)
+                        oom();
+                pxbuf_set_pool(pool);
+                if (gbl.verbose)
+                        printf("Using %d threads\n", threadpool_size(pool));
+                if (gbl.band) {
+                        mandelbrot_bands(optflags.outfile, gbl.band);
+                        pxbuf_set_pool(NULL);
+                        threadpool_destroy(pool);
+                        return 0;
+                }
+                mandelbrot(pxbuf, gbl.progressive
+                                  ? optflags.outfile : NULL);
+        }
 
         fp = fopen(optflags.outfile, "wb");
         if (!fp) {
@@ -330,18 +747,19 @@ main(int argc, char **argv)
         if (optflags.print_palette) {
                 print_palette_to_bmp(pxbuf);
         } else {
-                int i;
-                for (i = 0; i < gbl.nnorm; i++) {
-                        pxbuf_normalize(pxbuf, gbl.norm_method[i],
-                                gbl.norm_scale[i], gbl.linked);
-                }
-                if (gbl.negate)
-                        pxbuf_negate(pxbuf);
+                finish_pxbuf(pxbuf);
         }
 
-        pxbuf_print_to_bmp(pxbuf, fp, PXBUF_NORM_CLIP);
-        fclose(fp);
+        if (pxbuf_print(pxbuf, fp, pxbuf_format(optflags.outfile),
+                        PXBUF_NORM_CLIP, gbl.depth) < 0
+            || fclose(fp) != 0) {
+                fprintf(stderr, "Cannot write `%s'\n", optflags.outfile);
+                return 1;
+        }
+        if (pool) {
+                pxbuf_set_pool(NULL);
+                threadpool_destroy(pool);
+        }
         pxbuf_destroy(pxbuf);
         return 0;
 }
-
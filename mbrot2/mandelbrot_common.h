@@ -34,6 +34,7 @@
 #include "config.h"
 #include "fractal_common.h"
 #include "pxbuf.h"
+#include <stdint.h>
 
 #ifndef EGFRACTAL_MULTITHREADED
 # define EGFRACTAL_MULTITHREADED 0
@@ -49,10 +50,13 @@ extern struct gbl_t {
         unsigned int height;
         unsigned int width;
         unsigned int palette;
-        unsigned int nthread;
+        unsigned int nthread; /* 0 for one per CPU */
         mfloat_t zoom_pct;
         mfloat_t zoom_xoffs;
         mfloat_t zoom_yoffs;
+        /* -x and -y as typed, for --perturb */
+        const char *xoffs_str;
+        const char *yoffs_str;
         mfloat_t bailout;
         mfloat_t bailoutsqu;
         mfloat_t distance_root;
@@ -62,12 +66,23 @@ extern struct gbl_t {
         double greenspread;
         double bluespread;
         unsigned int min_iteration;
+        unsigned int aa; /* --aa, 1 for off */
+        unsigned int band; /* --band, rows per band, 0 for off */
+        unsigned int depth; /* --depth, bits per channel of a PNG */
+        mfloat_t aa_threshold;
         bool distance_est;
         bool verbose;
         bool negate;
         bool color_distance;
         bool color_spread;
         bool linked;
+        bool simd;
+        bool subdivide;
+        bool verify;
+        bool perturb;
+        bool affinity;
+        bool series;
+        bool progressive;
         enum pxbuf_norm_t norm_method[MAX_NORM_METHODS];
         int nnorm;
         complex_t (*formula)(complex_t, complex_t);
@@ -78,20 +93,27 @@ extern struct gbl_t {
 struct thread_info_t {
         mfloat_t min;
         mfloat_t max;
-        mfloat_t *buf;
+        mfloat_t *buf; /* whole image or band, shared by all threads */
+        int row0; /* first row in @buf */
         mfloat_t bailoutsqu;
         mfloat_t log_d;
         bool distance_est;
         bool dither;
-        int skip;
-        int rowstart;
-        int rowend;
-        int colstart;
-        int colend;
-        int bufsize;
-#if OLD_XY_TO_COMPLEX
+        bool simd; /* use escape_v() */
+        bool subdivide;
+        /* Only do every @stride'th pixel, but not every @prev_stride'th */
+        int stride;
+        int prev_stride; /* 0 if there's no coarser pass before this */
+        unsigned long nfilled; /* pixels filled in by subdividing */
+        mfloat_t period_eps;
+        struct escape_stats_t stats;
+        struct progress_t *progress; /* NULL unless --verbose */
+        const struct ref_orbit_t *ref; /* non-NULL for --perturb */
+        unsigned long nrebase;
+        struct tileq_t *tileq;
         int height;
         int width;
+#if OLD_XY_TO_COMPLEX
         mfloat_t zoom_pct;
         mfloat_t zoom_yoffs;
         mfloat_t zoom_xoffs;
@@ -104,11 +126,13 @@ struct thread_info_t {
         mfloat_t h4; /* global height / 4.0 */
         mfloat_t zx; /* 2*(zoom_pct)-zoom_xoffs */
         mfloat_t zy; /* 2*(zoom_pct)-zoom_yoffs */
+        mfloat_t zoom2; /* 2*(zoom_pct) */
 };
 
 /* palette.c */
 extern void get_color(mfloat_t idx, mfloat_t min,
                         mfloat_t max, struct pixel_t *px);
+extern mfloat_t color_index(mfloat_t esc_val, mfloat_t min, mfloat_t max);
 extern void print_palette_to_bmp(Pxbuf *pxbuf);
 
 /* parse_args.c */
@@ -118,8 +142,53 @@ struct optflags_t {
 };
 extern void parse_args(int argc, char **argv, struct optflags_t *optflags);
 
+/* bigfix.c */
+enum { BIGFIX_MAXLIMB = 48 };
+struct bigfix_t {
+        uint32_t l[BIGFIX_MAXLIMB];
+        bool neg;
+};
+extern int bigfix_set_precision(int fracbits);
+extern void bigfix_zero(struct bigfix_t *a);
+extern void bigfix_add(struct bigfix_t *dst, const struct bigfix_t *a,
+                       const struct bigfix_t *b);
+extern void bigfix_sub(struct bigfix_t *dst, const struct bigfix_t *a,
+                       const struct bigfix_t *b);
+extern void bigfix_mul(struct bigfix_t *dst, const struct bigfix_t *a,
+                       const struct bigfix_t *b);
+extern void bigfix_from_double(struct bigfix_t *dst, double v);
+extern double bigfix_to_double(const struct bigfix_t *a);
+extern int bigfix_parse(struct bigfix_t *dst, const char *s);
+
+/* perturb.c */
+struct ref_orbit_t {
+        complex_t *z;       /* z[0] through z[len-1] */
+        unsigned long len;
+        int bits;           /* precision it was calculated with */
+        /* Series approximation: pixels start at iteration @skip */
+        unsigned long skip;
+        complex_t a, b, c;
+};
+extern struct ref_orbit_t *ref_orbit_create(mfloat_t pixel_size);
+extern void ref_orbit_series(struct ref_orbit_t *ref, mfloat_t pixel_size);
+extern void ref_orbit_destroy(struct ref_orbit_t *ref);
+extern bool zoom_too_deep(mfloat_t pixel_size);
+
 /* mbrot_thread.c */
-extern void *mbrot_thread(void *arg);
+extern void mbrot_thread(void *arg);
+extern mfloat_t mbrot_sample(struct thread_info_t *ti,
+                             mfloat_t row, mfloat_t col);
+
+/* antialias.c */
+struct aa_info_t {
+        struct thread_info_t ti; /* ti.buf is the first pass's result */
+        Pxbuf *pxbuf;
+        int pxrow0; /* first row in @pxbuf */
+        mfloat_t min; /* range of the first pass, for get_color() */
+        mfloat_t max;
+        unsigned long nrefined; /* pixels that got resampled */
+};
+extern void aa_thread(void *arg);
 
 #endif /* MANDELBROT_COMMON_H */
 
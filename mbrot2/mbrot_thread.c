@@ -3,13 +3,36 @@
 
 static const mfloat_t INSIDE = -1.0L;
 
+static mfloat_t smooth_normal(unsigned long i, complex_t z,
+                              struct thread_info_t *ti);
+
+/*
+ * Brent's periodicity check, called after every iteration that didn't
+ * escape.  @zs is z as of iteration number @save.  Return true if
+ * @ztmp has come back around to it.
+ */
+static inline __attribute__((always_inline)) bool
+periodic(complex_t ztmp, complex_t *zs, unsigned long i,
+         unsigned long *save, mfloat_t eps2)
+{
+        complex_t d = complex_sub(ztmp, *zs);
+        if (complex_modulus2(d) < eps2)
+                return true;
+        if (i == *save) {
+                *zs = ztmp;
+                *save *= 2;
+        }
+        return false;
+}
+
 static mfloat_t
 iterate_normal(complex_t c, struct thread_info_t *ti)
 {
-        mfloat_t ret;
         unsigned long n = ti->n_iteration;
-        unsigned long i;
+        unsigned long i, save = 1;
         complex_t z = { .re = 0.0L, .im = 0.0L };
+        complex_t zs = z;
+        mfloat_t eps2 = ti->period_eps * ti->period_eps;
 
         /*
          * This is an ugly D.R.Y. violation,
@@ -21,12 +44,14 @@ iterate_normal(complex_t c, struct thread_info_t *ti)
                         complex_t ztmp = ti->formula(z, c);
                         /* Too precise for our data types. Assume inside. */
                         if (ztmp.re == z.re && ztmp.im == z.im)
-                                return INSIDE;
+                                goto inside;
 
                         if (!complex_isfinite(ztmp)
                             || complex_modulus2(ztmp) > ti->bailoutsqu) {
                                 break;
                         }
+                        if (periodic(ztmp, &zs, i, &save, eps2))
+                                goto periodic;
 
                         z = ztmp;
                 }
@@ -36,15 +61,37 @@ iterate_normal(complex_t c, struct thread_info_t *ti)
                         complex_t ztmp = complex_add(complex_sq(z), c);
                         /* Too precise for our data types. Assume inside. */
                         if (ztmp.re == z.re && ztmp.im == z.im)
-                                return INSIDE;
+                                goto inside;
                         if (complex_modulus2(ztmp) > ti->bailoutsqu)
                                 break;
+                        if (periodic(ztmp, &zs, i, &save, eps2))
+                                goto periodic;
                         z = ztmp;
                 }
         }
+        ti->stats.niter += i;
         if (i == n)
                 return INSIDE;
 
+        return smooth_normal(i, z, ti);
+
+periodic:
+        ti->stats.nperiodic++;
+inside:
+        ti->stats.niter += i;
+        return INSIDE;
+}
+
+/*
+ * Turn escape count @i into the value we save for the pixel.
+ * @z is the value before bailout.
+ */
+static mfloat_t
+smooth_normal(unsigned long i, complex_t z, struct thread_info_t *ti)
+{
+        unsigned long n = ti->n_iteration;
+        mfloat_t ret;
+
         /* i < n from here */
         ret = (mfloat_t)i;
         if (ti->dither > 0) {
@@ -133,20 +180,84 @@ iterate_distance(complex_t c, struct thread_info_t *ti)
          * It may be worthwhile to add a --inject-bug
          * option for this purpose alone.
          */
+        ti->stats.niter += i;
         if (i == n)
                 return INSIDE;
         zmod = complex_modulus(z);
         return zmod * log(zmod) / complex_modulus(dz);
 }
 
+/*
+ * Iterate a pixel as an offset from the reference orbit.
+ * See perturb.c for the gist of it.
+ */
+static mfloat_t
+iterate_perturb(mfloat_t row, mfloat_t col, struct thread_info_t *ti)
+{
+        const struct ref_orbit_t *ref = ti->ref;
+        unsigned long n = ti->n_iteration;
+        unsigned long i, m;
+        complex_t z, dz, dc, dc2;
+        mfloat_t ret;
+
+        /* Same as xy_to_complex(), but without adding the center */
+        dc.re = col * ti->w4 - ti->zoom2;
+        dc.im = row * ti->h4 - ti->zoom2;
+
+        /* Start where the series approximation leaves off */
+        dc2 = complex_sq(dc);
+        dz = complex_add(complex_mul(ref->a, dc),
+                         complex_mul(complex_add(ref->b,
+                                                 complex_mul(ref->c, dc)),
+                                     dc2));
+        m = ref->skip;
+        z = complex_add(ref->z[m], dz);
+
+        for (i = m; i < n; i++) {
+                complex_t ztmp;
+
+                /* dz = (2*Z + dz) * dz + dc */
+                ztmp = complex_add(complex_mulr(ref->z[m], 2.0), dz);
+                dz = complex_add(complex_mul(ztmp, dz), dc);
+                m++;
+
+                ztmp = complex_add(ref->z[m], dz);
+                if (complex_modulus2(ztmp) > ti->bailoutsqu)
+                        break;
+                z = ztmp;
+
+                /*
+                 * Rebase: once z gets closer to zero than dz is, the
+                 * reference orbit is no longer a good approximation of
+                 * this pixel, and the result would be garbage ("glitches"
+                 * in the deep-zoom lingo).  So start over from the
+                 * beginning of the reference, which is zero, using z
+                 * itself as the offset.  Same if we've run off the end
+                 * of the reference.
+                 */
+                if (m >= ref->len - 1
+                    || complex_modulus2(z) < complex_modulus2(dz)) {
+                        dz = z;
+                        m = 0;
+                        ti->nrebase++;
+                }
+        }
+        ti->stats.niter += i - ref->skip;
+        if (i == n)
+                return INSIDE;
+
+        ret = smooth_normal(i, z, ti);
+        return isfinite(ret) ? ret : INSIDE;
+}
+
 #if OLD_XY_TO_COMPLEX
 static inline __attribute__((always_inline)) complex_t
-xy_to_complex(int row, int col, struct thread_info_t *ti)
+xy_to_complex(mfloat_t row, mfloat_t col, struct thread_info_t *ti)
 {
         complex_t c;
 
-        c.re = 4.0L * (mfloat_t)col / (mfloat_t)ti->width  - 2.0L;
-        c.im = 4.0L * (mfloat_t)row / (mfloat_t)ti->height - 2.0L;
+        c.re = 4.0L * col / (mfloat_t)ti->width  - 2.0L;
+        c.im = 4.0L * row / (mfloat_t)ti->height - 2.0L;
 
         c.re = c.re * ti->zoom_pct - ti->zoom_xoffs;
         c.im = c.im * ti->zoom_pct - ti->zoom_yoffs;
@@ -155,7 +266,7 @@ xy_to_complex(int row, int col, struct thread_info_t *ti)
 #else
 /* scale pixels to points of mandelbrot set and handle zoom. */
 static inline __attribute__((always_inline)) complex_t
-xy_to_complex(int row, int col, struct thread_info_t *ti)
+xy_to_complex(mfloat_t row, mfloat_t col, struct thread_info_t *ti)
 {
         complex_t c;
         /*
@@ -168,36 +279,56 @@ xy_to_complex(int row, int col, struct thread_info_t *ti)
          * which is why the code below looks nothing like
          * the formula above.
          */
-        c.re = (mfloat_t)col * ti->w4 - ti->zx;
-        c.im = (mfloat_t)row * ti->h4 - ti->zy;
+        c.re = col * ti->w4 - ti->zx;
+        c.im = row * ti->h4 - ti->zy;
         return c;
 }
 #endif
 
-static mfloat_t
-mandelbrot_px(int row, int col, struct thread_info_t *ti)
+/*
+ * We know the formula for the main cardioid and bulb,
+ * and we know every point inside will converge.  So we
+ * can check that first before diving into the long
+ * iterative process.
+ */
+static bool
+known_inside(complex_t c, struct thread_info_t *ti)
 {
         /* XXX: Quite an arbitrary choice */
         enum { THRESHOLD = 10 };
+        mfloat_t xp, ysq, q;
+
+        if (ti->formula || ti->n_iteration <= THRESHOLD)
+                return false;
+
+        xp = c.re - 0.25L;
+        ysq = c.im * c.im;
+        q = xp * xp + ysq;
+        if ((q * (q + xp)) < (0.25L * ysq))
+                return true;
+        xp = c.re + 1.0L;
+        if ((xp * xp + ysq) < (0.25L * ysq))
+                return true;
+        return false;
+}
+
+/* @row and @col need not be whole numbers, see mbrot_sample() */
+static mfloat_t
+mandelbrot_px(mfloat_t row, mfloat_t col, struct thread_info_t *ti)
+{
         mfloat_t ret;
+        complex_t c;
 
-        complex_t c = xy_to_complex(row, col, ti);
-        if (!ti->formula && ti->n_iteration > THRESHOLD) {
-                /*
-                 * We know the formula for the main cardioid and bulb,
-                 * and we know every point inside will converge.  So we
-                 * can check that first before diving into the long
-                 * iterative process.
-                 */
-                mfloat_t xp = c.re - 0.25L;
-                mfloat_t ysq = c.im * c.im;
-                mfloat_t q = xp * xp + ysq;
-                if ((q * (q + xp)) < (0.25L * ysq))
-                        return INSIDE;
-                xp = c.re + 1.0L;
-                if ((xp * xp + ysq) < (0.25L * ysq))
-                        return INSIDE;
-        }
+        /*
+         * Skip known_inside(); c isn't precise enough at
+         * perturbation-sized zooms to trust it.
+         */
+        if (ti->ref)
+                return iterate_perturb(row, col, ti);
+
+        c = xy_to_complex(row, col, ti);
+        if (known_inside(c, ti))
+                return INSIDE;
 
         if (ti->distance_est)
                 ret = iterate_distance(c, ti);
@@ -208,23 +339,276 @@ mandelbrot_px(int row, int col, struct thread_info_t *ti)
         return ret;
 }
 
-void *
+static inline void
+save_px(struct thread_info_t *ti, int row, int col, mfloat_t v)
+{
+        if (v >= 0.0L && ti->min > v)
+                ti->min = v;
+        if (ti->max < v)
+                ti->max = v;
+        ti->buf[(row - ti->row0) * ti->width + col] = v;
+}
+
+/* Per-thread list of pixels for mbrot_px_list() */
+struct px_list_t {
+        size_t npx;
+        complex_t c[TILE_SIZE * TILE_SIZE];
+        complex_t z[TILE_SIZE * TILE_SIZE];
+        long count[TILE_SIZE * TILE_SIZE];
+        int row[TILE_SIZE * TILE_SIZE];
+        int col[TILE_SIZE * TILE_SIZE];
+};
+
+static inline void
+px_list_add(struct px_list_t *s, int row, int col)
+{
+        s->row[s->npx] = row;
+        s->col[s->npx] = col;
+        s->npx++;
+}
+
+/*
+ * Calculate every pixel in @s and empty it.
+ *
+ * If we're allowed, the pixels are handed to escape_v() to iterate
+ * several at once, otherwise it's the same as calling mandelbrot_px()
+ * for each one.
+ */
+static void
+mbrot_px_list(struct thread_info_t *ti, struct px_list_t *s)
+{
+        size_t npx = 0;
+        size_t i;
+
+        if (!ti->simd) {
+                for (i = 0; i < s->npx; i++) {
+                        save_px(ti, s->row[i], s->col[i],
+                                mandelbrot_px(s->row[i], s->col[i], ti));
+                }
+                s->npx = 0;
+                return;
+        }
+
+        /* Weed out the ones we already know about */
+        for (i = 0; i < s->npx; i++) {
+                complex_t c = xy_to_complex(s->row[i], s->col[i], ti);
+                if (known_inside(c, ti)) {
+                        save_px(ti, s->row[i], s->col[i], INSIDE);
+                        continue;
+                }
+                s->c[npx]   = c;
+                s->row[npx] = s->row[i];
+                s->col[npx] = s->col[i];
+                npx++;
+        }
+
+        escape_v(s->z, s->c, s->count, npx, ti->n_iteration,
+                 ti->bailoutsqu, ti->period_eps, ESCAPE_MANDELBROT,
+                 &ti->stats);
+
+        for (i = 0; i < npx; i++) {
+                mfloat_t v = INSIDE;
+                if (s->count[i] >= 0) {
+                        v = smooth_normal(s->count[i], s->z[i], ti);
+                        if (!isfinite(v))
+                                v = INSIDE;
+                }
+                save_px(ti, s->row[i], s->col[i], v);
+        }
+        s->npx = 0;
+}
+
+/*
+ * Calculate every ti->stride'th pixel of @tile in each direction,
+ * except the ones an earlier, coarser --progressive pass already did.
+ * Tiles start on multiples of TILE_SIZE, so the grid lines up from one
+ * tile to the next.  Return the number of pixels calculated.
+ */
+static unsigned long
+mbrot_tile(struct thread_info_t *ti, struct tile_t *tile,
+           struct px_list_t *s)
+{
+        int stride = ti->stride;
+        int prev = ti->prev_stride;
+        unsigned long npx;
+        int row, col;
+
+        for (row = tile->rowstart; row < tile->rowend; row += stride) {
+                for (col = tile->colstart; col < tile->colend;
+                     col += stride) {
+                        if (prev && row % prev == 0 && col % prev == 0)
+                                continue;
+                        px_list_add(s, row, col);
+                }
+        }
+        npx = s->npx;
+        mbrot_px_list(ti, s);
+        return npx;
+}
+
+static inline mfloat_t
+get_px(struct thread_info_t *ti, int row, int col)
+{
+        return ti->buf[(row - ti->row0) * ti->width + col];
+}
+
+/*
+ * Return true if every pixel on the edges of the rectangle from
+ * (@r0,@c0) to (@r1,@c1), inclusive, has the same value.
+ */
+static bool
+border_is_uniform(struct thread_info_t *ti, int r0, int r1, int c0, int c1)
+{
+        mfloat_t v = get_px(ti, r0, c0);
+        int row, col;
+
+        for (col = c0; col <= c1; col++) {
+                if (get_px(ti, r0, col) != v || get_px(ti, r1, col) != v)
+                        return false;
+        }
+        for (row = r0 + 1; row < r1; row++) {
+                if (get_px(ti, row, c0) != v || get_px(ti, row, c1) != v)
+                        return false;
+        }
+        return true;
+}
+
+/*
+ * Mariani-Silver subdivision of the rectangle from (@r0,@c0) to
+ * (@r1,@c1), inclusive, whose edges have already been calculated.
+ *
+ * The Mandelbrot set is connected, and so are the bands of equal
+ * escape count around it.  So if the whole border of a rectangle has
+ * the same value, everything inside it must too, and we can fill it
+ * in without iterating any of it.  Otherwise, split the rectangle in
+ * four, calculate the two lines between the quarters, and try again
+ * with each quarter.
+ *
+ * That reasoning only holds for plain z^2+c; for the other formulas
+ * this is just a (usually pretty good) guess.
+ */
+static void
+subdivide(struct thread_info_t *ti, int r0, int r1, int c0, int c1,
+          struct px_list_t *s)
+{
+        /* Below this it's cheaper to just calculate everything */
+        enum { MIN_SIZE = 6 };
+        int row, col, rm, cm;
+
+        /* No interior */
+        if (r1 - r0 < 2 || c1 - c0 < 2)
+                return;
+
+        if (border_is_uniform(ti, r0, r1, c0, c1)) {
+                mfloat_t v = get_px(ti, r0, c0);
+                for (row = r0 + 1; row < r1; row++) {
+                        for (col = c0 + 1; col < c1; col++)
+                                ti->buf[(row - ti->row0) * ti->width
+                                        + col] = v;
+                }
+                ti->nfilled += (r1 - r0 - 1) * (c1 - c0 - 1);
+                return;
+        }
+
+        if (r1 - r0 <= MIN_SIZE || c1 - c0 <= MIN_SIZE) {
+                for (row = r0 + 1; row < r1; row++) {
+                        for (col = c0 + 1; col < c1; col++)
+                                px_list_add(s, row, col);
+                }
+                mbrot_px_list(ti, s);
+                return;
+        }
+
+        rm = (r0 + r1) / 2;
+        cm = (c0 + c1) / 2;
+        for (col = c0 + 1; col < c1; col++)
+                px_list_add(s, rm, col);
+        for (row = r0 + 1; row < r1; row++) {
+                if (row != rm)
+                        px_list_add(s, row, cm);
+        }
+        mbrot_px_list(ti, s);
+
+        subdivide(ti, r0, rm, c0, cm, s);
+        subdivide(ti, r0, rm, cm, c1, s);
+        subdivide(ti, rm, r1, c0, cm, s);
+        subdivide(ti, rm, r1, cm, c1, s);
+}
+
+static void
+mbrot_tile_subdivide(struct thread_info_t *ti, struct tile_t *tile,
+                     struct px_list_t *s)
+{
+        int r0 = tile->rowstart;
+        int r1 = tile->rowend - 1;
+        int c0 = tile->colstart;
+        int c1 = tile->colend - 1;
+        int row, col;
+
+        /* Start with the tile's own border */
+        for (col = c0; col <= c1; col++) {
+                px_list_add(s, r0, col);
+                if (r1 != r0)
+                        px_list_add(s, r1, col);
+        }
+        for (row = r0 + 1; row < r1; row++) {
+                px_list_add(s, row, c0);
+                if (c1 != c0)
+                        px_list_add(s, row, c1);
+        }
+        mbrot_px_list(ti, s);
+
+        subdivide(ti, r0, r1, c0, c1, s);
+}
+
+/**
+ * mbrot_sample - Calculate one point of the image without saving it
+ * @ti: Thread's info, set up the same as for mbrot_thread()
+ * @row: Row of the point, which may be anywhere between pixels
+ * @col: Column of the point, likewise
+ *
+ * Return the value mbrot_thread() would have saved for a pixel there.
+ */
+mfloat_t
+mbrot_sample(struct thread_info_t *ti, mfloat_t row, mfloat_t col)
+{
+        return mandelbrot_px(row, col, ti);
+}
+
+/**
+ * mbrot_thread - Thread pool task for mbrot2, one per worker
+ * @arg: Pointer to a struct thread_info_t
+ */
+void
 mbrot_thread(void *arg)
 {
         struct thread_info_t *ti = (struct thread_info_t *)arg;
-        int row, col;
+        struct px_list_t *list;
+        struct tile_t tile;
+
+        list = malloc(sizeof(*list));
+        if (!list) {
+                fprintf(stderr, "OOM!\n");
+                exit(EXIT_FAILURE);
+        }
+        list->npx = 0;
+
+        while (tileq_next(ti->tileq, &tile)) {
+                unsigned long niter = ti->stats.niter;
+                unsigned long npx;
+
+                if (ti->subdivide) {
+                        mbrot_tile_subdivide(ti, &tile, list);
+                        npx = (tile.rowend - tile.rowstart)
+                              * (tile.colend - tile.colstart);
+                } else {
+                        npx = mbrot_tile(ti, &tile, list);
+                }
 
-        mfloat_t *pbuf = ti->buf;
-        for (row = ti->rowstart; row < ti->rowend; row += ti->skip) {
-                for (col = ti->colstart; col < ti->colend; col++) {
-                        mfloat_t v;
-                        v = mandelbrot_px(row, col, ti);
-                        if (v >= 0.0L && ti->min > v)
-                                ti->min = v;
-                        if (ti->max < v)
-                                ti->max = v;
-                        *pbuf++ = v;
+                if (ti->progress) {
+                        progress_add(ti->progress, npx,
+                                     ti->stats.niter - niter);
                 }
         }
-        return NULL;
+        free(list);
 }
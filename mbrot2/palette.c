@@ -397,6 +397,31 @@ get_color(mfloat_t esc_val, mfloat_t min, mfloat_t max, struct pixel_t *px)
         }
 }
 
+/**
+ * color_index - Where get_color() would look up @esc_val in the palette
+ *
+ * Return the position along the palette, in palette entries, or a
+ * negative number if @esc_val gets the inside color.  Two values
+ * whose positions are more than an entry or so apart come out as
+ * noticeably different colors.
+ */
+mfloat_t
+color_index(mfloat_t esc_val, mfloat_t min, mfloat_t max)
+{
+        if (gbl.distance_est) {
+                if (esc_val <= 0.0L || max <= min)
+                        return -1.0L;
+                if (esc_val > max)
+                        esc_val = max;
+                else if (esc_val < min)
+                        esc_val = min;
+                return scaled_distance(esc_val, max, min) * (mfloat_t)NCOLOR;
+        }
+        if (esc_val <= 0.0L || (int)esc_val >= gbl.n_iteration)
+                return -1.0L;
+        return esc_val;
+}
+
 /* XXX REVISIT: Hierarchically asymmetrical to get_color() */
 void
 print_palette_to_bmp(Pxbuf *pxbuf)
@@ -156,6 +156,16 @@ parse_args(int argc, char **argv, struct optflags_t *optflags)
                 { "color-distance", no_argument,       NULL, 4 },
                 { "nthread",        required_argument, NULL, 7 },
                 { "spread",         optional_argument, NULL, 8 },
+                { "no-simd",        no_argument,       NULL, 9 },
+                { "subdivide",      optional_argument, NULL, 10 },
+                { "perturb",        no_argument,       NULL, 11 },
+                { "no-series",      no_argument,       NULL, 12 },
+                { "affinity",       no_argument,       NULL, 13 },
+                { "aa",             required_argument, NULL, 14 },
+                { "aa-threshold",   required_argument, NULL, 15 },
+                { "progressive",    no_argument,       NULL, 16 },
+                { "band",           optional_argument, NULL, 17 },
+                { "depth",          required_argument, NULL, 18 },
                 { "distance",       optional_argument, NULL, 'D' },
                 { "norm",           required_argument, NULL, 'N' },
                 { "bailout",        required_argument, NULL, 'b' },
@@ -217,6 +227,60 @@ parse_args(int argc, char **argv, struct optflags_t *optflags)
                                 bad_arg("--spread", optarg);
                         }
                         break;
+                case 9:
+                        gbl.simd = false;
+                        break;
+                case 10:
+                        gbl.subdivide = true;
+                        if (optarg) {
+                                if (strcmp(optarg, "verify"))
+                                        bad_arg("--subdivide", optarg);
+                                gbl.verify = true;
+                        }
+                        break;
+                case 11:
+                        gbl.perturb = true;
+                        break;
+                case 12:
+                        gbl.series = false;
+                        break;
+                case 13:
+                        gbl.affinity = true;
+                        break;
+                case 14:
+                        gbl.aa = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg || *endptr != '\0'
+                            || gbl.aa < 1 || gbl.aa > 16) {
+                                bad_arg("--aa", optarg);
+                        }
+                        break;
+                case 15:
+                        gbl.aa_threshold = strtod(optarg, &endptr);
+                        if (endptr == optarg || !isfinite(gbl.aa_threshold)
+                            || gbl.aa_threshold < 0.0) {
+                                bad_arg("--aa-threshold", optarg);
+                        }
+                        break;
+                case 16:
+                        gbl.progressive = true;
+                        break;
+                case 17:
+                        gbl.band = 256;
+                        if (optarg) {
+                                gbl.band = strtoul(optarg, &endptr, 0);
+                                if (endptr == optarg || *endptr != '\0'
+                                    || gbl.band < 1) {
+                                        bad_arg("--band", optarg);
+                                }
+                        }
+                        break;
+                case 18:
+                        gbl.depth = strtoul(optarg, &endptr, 0);
+                        if (endptr == optarg || *endptr != '\0'
+                            || (gbl.depth != 8 && gbl.depth != 16)) {
+                                bad_arg("--depth", optarg);
+                        }
+                        break;
                 case 'D':
                         gbl.distance_est = true;
                         if (optarg) {
@@ -274,11 +338,13 @@ parse_args(int argc, char **argv, struct optflags_t *optflags)
                         gbl.zoom_xoffs = strtold(optarg, &endptr);
                         if (endptr == optarg)
                                 bad_arg("-x --x-offs", optarg);
+                        gbl.xoffs_str = optarg;
                         break;
                 case 'y':
                         gbl.zoom_yoffs = strtold(optarg, &endptr);
                         if (endptr == optarg)
                                 bad_arg("-y --y-offs", optarg);
+                        gbl.yoffs_str = optarg;
                         break;
                 case 'z':
                         gbl.zoom_pct = strtold(optarg, &endptr);
@@ -300,6 +366,30 @@ parse_args(int argc, char **argv, struct optflags_t *optflags)
                 gbl.norm_scale[0] = 1.0;
         }
 
+        if (gbl.perturb && (gbl.formula || gbl.distance_est)) {
+                fprintf(stderr, "--perturb only works with the default "
+                        "formula and without -D\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (gbl.progressive && gbl.subdivide) {
+                fprintf(stderr, "--progressive and --subdivide "
+                        "cannot be used together\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (gbl.band && (gbl.progressive || gbl.verify)) {
+                fprintf(stderr, "--band cannot be used with --progressive "
+                        "or --subdivide=verify\n");
+                exit(EXIT_FAILURE);
+        }
+
+        if (gbl.depth != 8 && pxbuf_format(optflags->outfile) != PXBUF_PNG) {
+                fprintf(stderr, "--depth=%u needs a .png output file\n",
+                        gbl.depth);
+                exit(EXIT_FAILURE);
+        }
+
         if (!EGFRACTAL_MULTITHREADED)
                 gbl.nthread = 1;
 }
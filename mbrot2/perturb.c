@@ -0,0 +1,212 @@
+/*
+ * perturb.c - Reference orbit for perturbation-theory deep zooms
+ *
+ * Past a zoom of about 1e-13, neighboring pixels are closer together
+ * than a double can tell apart, and the picture turns to mush.  The
+ * trick around that is to iterate just one point, the center of the
+ * image, in high precision (the "reference orbit" Z), and iterate
+ * every pixel as a tiny offset dz from it:
+ *
+ *      z = Z + dz
+ *      dz' = 2*Z*dz + dz^2 + dc
+ *
+ * where dc is the pixel's offset from the center.  The offsets are
+ * small, so plain doubles have plenty of precision for them.  See
+ * iterate_perturb() in mbrot_thread.c for the per-pixel half of this.
+ */
+#include "mandelbrot_common.h"
+#include <stdlib.h>
+#include <float.h>
+
+/* Keep the integer part of bigfix_t from overflowing */
+static const mfloat_t REF_BAILOUT_MAX = 268435456.0; /* 2^28 */
+
+static void
+parse_center(struct bigfix_t *dst, const char *s, mfloat_t v)
+{
+        if (s == NULL || bigfix_parse(dst, s) < 0)
+                bigfix_from_double(dst, v);
+}
+
+/**
+ * ref_orbit_create - Calculate the reference orbit for the image center
+ * @pixel_size: Distance between two neighboring pixels
+ *
+ * The center is -gbl.zoom_xoffs, -gbl.zoom_yoffs (yes, backwards,
+ * to match xy_to_complex()), except that we use the digits the user
+ * typed in, if there were any, since zoom_xoffs and zoom_yoffs have
+ * already lost most of them.
+ *
+ * Return the orbit, or NULL if out of memory.
+ */
+struct ref_orbit_t *
+ref_orbit_create(mfloat_t pixel_size)
+{
+        struct bigfix_t cr, ci, zr, zi, zr2, zi2, zri;
+        struct ref_orbit_t *ref;
+        mfloat_t bailoutsqu = gbl.bailoutsqu;
+        unsigned long i, n = gbl.n_iteration;
+        int bits;
+
+        ref = malloc(sizeof(*ref));
+        if (!ref)
+                return NULL;
+        ref->z = malloc(sizeof(*ref->z) * (n + 1));
+        if (!ref->z) {
+                free(ref);
+                return NULL;
+        }
+
+        /*
+         * Enough bits to resolve one pixel, plus a bunch more since
+         * the reference orbit's errors grow as we iterate.
+         */
+        bits = 64;
+        if (pixel_size > 0.0 && pixel_size < 1.0)
+                bits += (int)ceil(-log2(pixel_size));
+        ref->bits = bigfix_set_precision(bits);
+
+        parse_center(&cr, gbl.xoffs_str, gbl.zoom_xoffs);
+        parse_center(&ci, gbl.yoffs_str, gbl.zoom_yoffs);
+        cr.neg = !cr.neg;
+        ci.neg = !ci.neg;
+
+        if (bailoutsqu > REF_BAILOUT_MAX)
+                bailoutsqu = REF_BAILOUT_MAX;
+
+        bigfix_zero(&zr);
+        bigfix_zero(&zi);
+        ref->z[0].re = 0.0;
+        ref->z[0].im = 0.0;
+        for (i = 1; i <= n; i++) {
+                complex_t z;
+
+                /* z = z^2 + c */
+                bigfix_mul(&zr2, &zr, &zr);
+                bigfix_mul(&zi2, &zi, &zi);
+                bigfix_mul(&zri, &zr, &zi);
+                bigfix_sub(&zr, &zr2, &zi2);
+                bigfix_add(&zr, &zr, &cr);
+                bigfix_add(&zi, &zri, &zri);
+                bigfix_add(&zi, &zi, &ci);
+
+                z.re = bigfix_to_double(&zr);
+                z.im = bigfix_to_double(&zi);
+                ref->z[i] = z;
+
+                /*
+                 * It's okay for the reference to escape before the
+                 * pixels do.  They'll just rebase when they reach the
+                 * end of it.
+                 */
+                if (complex_modulus2(z) > bailoutsqu) {
+                        i++;
+                        break;
+                }
+        }
+        ref->len = i;
+        ref->skip = 0;
+        return ref;
+}
+
+/*
+ * How close the series has to be: its truncation error at the corners
+ * of the image, as a fraction of the distance between two neighboring
+ * pixels' orbits.  This has to be a lot smaller than you'd think.
+ * Pixels near the edge of the set are touchy enough that an error of
+ * a thousandth of a pixel changes their escape counts by hundreds.
+ */
+static const mfloat_t SERIES_TOL = 1.0 / 1048576.0;
+
+/**
+ * ref_orbit_series - Find how many iterations the pixels can skip
+ * @ref: Reference orbit, from ref_orbit_create()
+ * @pixel_size: Distance between two neighboring pixels
+ *
+ * Every pixel's offset from the reference, dz, is a polynomial in its
+ * own offset dc.  Truncated to the first three terms:
+ *
+ *      dz[n] = A[n]*dc + B[n]*dc^2 + C[n]*dc^3
+ *
+ * where, from dz' = 2*Z*dz + dz^2 + dc,
+ *
+ *      A' = 2*Z*A + 1
+ *      B' = 2*Z*B + A^2
+ *      C' = 2*Z*C + 2*A*B
+ *
+ * Deep in a zoom, this stays accurate for a long time, so the pixels
+ * can start at that iteration instead of at zero.  We stop when:
+ *
+ * - the dc^3 term gets big enough to matter, taking it as a stand-in
+ *   for the terms we dropped;
+ * - dz could get as big as half of Z, which is where pixels would
+ *   start to rebase (or worse, where they're about to escape);
+ * - we run out of reference orbit or iterations.  At least one step
+ *   of the reference is left over for the pixels, since an orbit that
+ *   escapes early may not trip either of the others first.
+ *
+ * Sets @ref->skip and the coefficients at @ref->skip.
+ */
+void
+ref_orbit_series(struct ref_orbit_t *ref, mfloat_t pixel_size)
+{
+        /* Farthest pixel from the center is a corner */
+        mfloat_t d = 2.0 * M_SQRT2 * gbl.zoom_pct;
+        mfloat_t d2 = d * d;
+        mfloat_t d3 = d2 * d;
+        complex_t a = { .re = 0.0, .im = 0.0 };
+        complex_t b = a, c = a;
+        unsigned long i, n;
+
+        n = ref->len > 1 ? ref->len - 2 : 0;
+        if (n > gbl.n_iteration)
+                n = gbl.n_iteration;
+
+        for (i = 0; i < n; i++) {
+                complex_t z2 = complex_mulr(ref->z[i], 2.0);
+                complex_t na, nb, nc;
+                mfloat_t amod, dzmax, zmod;
+
+                na = complex_addr(complex_mul(z2, a), 1.0);
+                nb = complex_add(complex_mul(z2, b), complex_sq(a));
+                nc = complex_add(complex_mul(z2, c),
+                                 complex_mulr(complex_mul(a, b), 2.0));
+
+                amod = complex_modulus(na);
+                dzmax = amod * d + complex_modulus(nb) * d2
+                        + complex_modulus(nc) * d3;
+                zmod = complex_modulus(ref->z[i + 1]);
+                if (complex_modulus(nc) * d3 > SERIES_TOL * amod * pixel_size
+                    || dzmax > 0.5 * zmod
+                    || !isfinite(dzmax)) {
+                        break;
+                }
+                a = na;
+                b = nb;
+                c = nc;
+        }
+        ref->skip = i;
+        ref->a = a;
+        ref->b = b;
+        ref->c = c;
+}
+
+void
+ref_orbit_destroy(struct ref_orbit_t *ref)
+{
+        free(ref->z);
+        free(ref);
+}
+
+/*
+ * Return true if a zoom at @pixel_size is too deep for plain doubles
+ * to tell neighboring pixels apart.
+ */
+bool
+zoom_too_deep(mfloat_t pixel_size)
+{
+        mfloat_t mag = fmax(fabs(gbl.zoom_xoffs), fabs(gbl.zoom_yoffs));
+        if (mag < 1.0)
+                mag = 1.0;
+        return pixel_size < 16.0 * DBL_EPSILON * mag;
+}